@@ -15,11 +15,19 @@ extern void		ei(void);
 extern int		wd_open(int);
 extern char		wd_read(unsigned int, int);
 extern char		wd_write(unsigned int, int);
+extern int		wd_start(unsigned int, bufptr);
 
 /* devfd.c */
 extern int		fd_open(int);
 extern unsigned int	fd_read(int16, int);
 extern unsigned int	fd_write(int16, int);
+extern int		fd_close(int);
+extern int		fd_ioctl(int, int, char *);
+
+/* devrd.c */
+extern int		rd_open(int);
+extern unsigned int	rd_read(int, int);
+extern unsigned int	rd_write(int, int);
 
 /* devtty.c */
 extern int		tty_open(int);
@@ -36,21 +44,56 @@ extern unsigned int	lpr_write(int, int);
 extern unsigned int	mem_read(int, int);
 extern unsigned int	mem_write(int, int);
 extern unsigned int	null_write(int, int);
+extern unsigned int	kst_read(int, int);
+extern int		kt_open(int);
+extern unsigned int	kt_read(int, int);
+
+/*
+ * scsistart() and scsiend() have not been run on the hardware yet, so
+ * only the hosted build starts disk commands without waiting for them.
+ */
+#ifdef HOSTED
+#define WDSTART	wd_start
+#else
+#define WDSTART	nogood
+#endif
 
 /* The device driver switch table */
 static struct devsw dev_tab[] = {
-	{ 0x2b38, wd_open, ok, wd_read, wd_write, nogood },
-	{ 0, fd_open, ok, fd_read, fd_write, nogood },		/* floppy */
-	{ 0x3844, wd_open, ok, wd_read, wd_write, nogood },
-	{ 0x252b, wd_open, ok, wd_read, wd_write, nogood },	/* swap */
-	{ 0, lpr_open, lpr_close, nogood, lpr_write, nogood },	/* printer */
-	{ 0, tty_open, tty_close, tty_read, tty_write, ok },	/* tty */
-	{ 0, ok, ok, ok, null_write, nogood },			/* /dev/null */
-	{ 0, ok, ok, mem_read, mem_write, nogood },		/* /dev/mem */
+	{ 0, wd_open, ok, wd_read, wd_write, nogood, WDSTART },
+	{ 0, fd_open, fd_close, fd_read, fd_write, fd_ioctl, nogood }, /* fd */
+	{ 1, wd_open, ok, wd_read, wd_write, nogood, WDSTART },
+	{ 2, wd_open, ok, wd_read, wd_write, nogood, WDSTART },	/* swap */
+	/* printer */
+	{ 0, lpr_open, lpr_close, nogood, lpr_write, nogood, nogood },
+	{ 0, tty_open, tty_close, tty_read, tty_write, ok, nogood }, /* tty */
+	{ 0, ok, ok, ok, null_write, nogood, nogood },		/* /dev/null */
+	{ 0, ok, ok, mem_read, mem_write, nogood, nogood },	/* /dev/mem */
+	{ 0, ok, ok, kst_read, nogood, nogood, nogood },	/* /dev/kstat */
+	{ 0, kt_open, ok, kt_read, nogood, nogood, nogood },	/* /dev/ktrace */
+	{ 0, rd_open, ok, rd_read, rd_write, nogood, nogood },	/* RAM disk */
+	{ 1, rd_open, ok, rd_read, rd_write, nogood, nogood },	/* RAM swap */
 };
 #endif
 
 #define NBUFS	4	/* Number of block buffers. */
-#define NDEVS	3	/* Devices 0..NDEVS-1 are capable of being mounted. */
-#define SWAPDEV	3	/* Device for swapping. */
+#define NPREALLOC 8	/* Blocks reserved ahead of a file being appended. */
+#define NFREEBATCH 64	/* Blocks sorted together when a file is truncated. */
+#define WBAGE	5	/* Seconds a dirty buffer waits to be written back, */
+#define WBMETA	30	/* and between writebacks of inodes and superblocks. */
+#define NKTRACE	32	/* Records in the system call trace, with KTRACE. */
+#define FDIL	1	/* Floppy sector interleave, */
+#define FDSKEW	0	/* and skew from one track to the next. */
+#define FDROTMS	166	/* Floppy revolution time, in ms (360 rpm). */
+#define NBANKS	0	/* Banks to keep processes in; 0 swaps each switch. */
+#define PBANK	2	/* The first of them. */
+#define TMPSTK	384	/* Bytes of stack to swap in on, with NBANKS. */
+#define NSWCACHE 0	/* Banks after them caching swapped-out processes. */
+#define SWAPZ	0	/* 1 to run-length compress images swapped out. */
+#define RDBLKS	2048	/* RAM disk size, in 512-byte blocks, */
+#define RDSWAP	1312	/* The last of them, minor 1, for swap (PTABSIZE*65+1). */
+#define NDEVS	4	/* Devices capable of being mounted: 0..NDEVS-2, */
+#define RDDEV	10	/* and the RAM disk. */
+#define NSWAPDEV 1	/* Devices to swap to, process slots taking turns: */
+#define SWAPDEVS { 3 }	/* 3 the disk's swap, 11 the RAM disk's. */
 #define TTYDEV	5	/* Device used by kernel for messages and panics. */
@@ -11,13 +11,45 @@ UZI (Unix Z80 Implementation) Kernel:  devfd.c
 static char ftrack, fsector, ferror;
 static char *fbuf;
 
+/*
+ * The track last used is kept whole.  Reads of its blocks are
+ * served from it, and writes go into it and are written back a
+ * track at a time, when another track is wanted or on sync or close.
+ */
+static char	trkbuf[NUMSECS * 128];
+static char	trkno = -1;	/* The track in trkbuf, or -1. */
+static char	trkdirty;
+
+/*
+ * The drive has an interleave and a track-to-track skew.  Logical
+ * sector s of track t is physical sector
+ *
+ *	(fdmap[s] + t * skew) % NUMSECS + 1
+ *
+ * where fdmap places the logical sectors il physical sectors apart.
+ * Interleave 1 and skew 0 is the plain order; a drive and controller
+ * that cannot take back-to-back sectors want a larger interleave,
+ * and a skew of about the step time in sectors lets the first sector
+ * of the next track come under the head just after it has settled.
+ * The order is fixed once a diskette has been written: mkfs -f
+ * lays out an image for the same numbers.
+ */
+static struct {
+	char	f_il;
+	char	f_skew;
+	char	f_map[NUMSECS];
+} fdgeom;
+
 int			fd_open(int);
 unsigned int		fd_read(int16, int);
 unsigned int		fd_write(int16, int);
+int			fd_close(int);
+int			fd_ioctl(int, int, char *);
 
-static int		fd_close(int);
-static int		fd_ioctl(int);
 static unsigned int	fd(int, int, int);
+static void		trkflush(void);
+static void		trkio(int);
+static void		fdmap(int, int);
 
 static			read();
 static			write();
@@ -26,11 +58,17 @@ static			reset();
 int
 fd_open(int minor)
 {
-	if (in(0x80) & 0x81) {
+	if (minor != 0 || (in(0x80) & 0x81)) {
 		udata.u_error = ENXIO;
 		return (-1);
 	}
+	ifnot (fdgeom.f_il)
+		fdmap(FDIL, FDSKEW);
 	reset();
+
+	/* The disk may have been changed. */
+	trkflush();
+	trkno = -1;
 	return (0);
 }
 
@@ -46,23 +84,57 @@ fd_write(int16 minor, int rawflag)
 	return (fd(0, minor, rawflag));
 }
 
-static int
+int
 fd_close(int minor)
 {
+	trkflush();
 	return (0);
 }
 
-static int
-fd_ioctl(int minor)
+/*
+ * Besides DIOSYNC, FDGETIL and FDSETIL get and set the drive's
+ * interleave and skew, two chars at data in the user's memory.
+ */
+int
+fd_ioctl(int minor, int request, char *data)
 {
+	switch (request) {
+	case DIOSYNC:
+		trkflush();
+		return (0);
+	case FDGETIL:
+		ifnot (valadr(data, 2))
+			return (-1);
+		data[0] = fdgeom.f_il;
+		data[1] = fdgeom.f_skew;
+		return (0);
+	case FDSETIL:
+		ifnot (valadr(data, 2))
+			return (-1);
+		if (data[0] < 1 || data[0] >= NUMSECS ||
+		    data[1] < 0 || data[1] >= NUMSECS)
+			return (-1);
+		trkflush();
+		trkno = -1;
+		fdmap(data[0], data[1]);
+		return (0);
+	}
 	return (-1);
 }
 
+/*
+ * fd moves the 128-byte sectors of a transfer between the caller
+ * and the track buffer, a track's worth at a time, bringing each
+ * track in first unless all of it is being written.
+ */
 static unsigned int
 fd(int rwflag, int minor, int rawflag)
 {
 	unsigned int nblocks;
 	unsigned int firstblk;
+	unsigned int n;
+	int track;
+	int sec;
 
 	if (rawflag) {
 		if (rawflag == 2) {
@@ -75,40 +147,138 @@ fd(int rwflag, int minor, int rawflag)
 			firstblk = udata.u_offset.o_blkno * 4;
 		}
 	} else {
-		nblocks = 4;
+		nblocks = 4 << (udata.u_buf->bf_shift - 9);
 		fbuf = udata.u_buf->bf_data;
-		firstblk = udata.u_buf->bf_blk * 4;
+		firstblk = udata.u_buf->bf_blk * nblocks;
 	}
 
-	ftrack = firstblk / 26; 
-	fsector = firstblk % 26 + 1;
-	ferror = 0;
+	while (nblocks) {
+		track = firstblk / NUMSECS;
+		sec = firstblk % NUMSECS;
+		n = NUMSECS - sec;
+		if (n > nblocks)
+			n = nblocks;
 
-	for (;;) {
+		if (track != trkno) {
+			trkflush();
+			trkno = track;
+			if (rwflag || n != NUMSECS)
+				trkio(1);
+		}
+		if (rwflag)
+			bcopy(trkbuf + sec * 128, fbuf, n * 128);
+		else {
+			bcopy(fbuf, trkbuf + sec * 128, n * 128);
+			trkdirty = 1;
+		}
+
+		fbuf += n * 128;
+		firstblk += n;
+		nblocks -= n;
+	}
+	return (nblocks);
+}
+
+/*
+ * trkflush writes the track buffer back if it has been written to.
+ */
+static void
+trkflush(void)
+{
+	if (trkdirty) {
+		trkio(0);
+		trkdirty = 0;
+	}
+}
+
+/*
+ * trkio reads (rwflag 1) or writes the whole track buffer, sector
+ * by sector in logical order, with read() and write()'s seek and
+ * retry logic.  The clock ticks it takes are counted in revolutions
+ * of the disk, which is what the interleave and skew are tuned by.
+ */
+static void
+trkio(int rwflag)
+{
+	char *p;
+	char *map;
+	uint32 t0;
+	int s;
+
+	p = fbuf;
+	fbuf = trkbuf;
+	ftrack = trkno;
+	ferror = 0;
+	map = fdgeom.f_map;
+	s = trkno * fdgeom.f_skew;
+	t0 = (uint32)ticks.t_date * (60 * TICKSPERSEC) + ticks.t_time;
+	for (fbuf = trkbuf; fbuf < trkbuf + NUMSECS * 128; fbuf += 128) {
+		fsector = (*map++ + s) % NUMSECS + 1;
+		++kstat.ks_dcmd;
 		if (rwflag)
 			read();
 		else
 			write();
-
-		ifnot (--nblocks)
-			break;
-
-		if (++fsector == 27) {
-			fsector = 1;
-			++ftrack;
+		if (ferror) {
+			kprintf("fd_%s: error %d track %d sector %d\n",
+			    rwflag ? "read" : "write", ferror, ftrack, fsector);
+			panic("");
 		}
-		fbuf += 128;
 	}
+	t0 = (uint32)ticks.t_date * (60 * TICKSPERSEC) + ticks.t_time - t0;
+	++kstat.ks_fdtrk;
+	kstat.ks_fdrot += (t0 * (1000 / TICKSPERSEC) + FDROTMS / 2) / FDROTMS;
+	fbuf = p;
+}
+
+/*
+ * fdmap sets the interleave and skew and lays out the map:
+ * each logical sector goes il physical sectors past the last, or
+ * to the next free one after that.
+ */
+static void
+fdmap(int il, int skew)
+{
+	char used[NUMSECS];
+	int p;
+	int j;
 
-	if (ferror) {
-		kprintf("fd_%s: error %d track %d sector %d\n",
-		    rwflag ? "read" : "write", ferror, ftrack, fsector);
-		panic("");
+	fdgeom.f_il = il;
+	fdgeom.f_skew = skew;
+	bzero(used, NUMSECS);
+	p = 0;
+	for (j = 0; j < NUMSECS; ++j) {
+		while (used[p])
+			p = (p + 1) % NUMSECS;
+		fdgeom.f_map[j] = p;
+		used[p] = 1;
+		p = (p + il) % NUMSECS;
 	}
+}
 
-	return (nblocks);
+#ifdef HOSTED
+/*
+ * The hosted build has no floppy controller: its status port always
+ * says not ready, so fd_open() fails and these are never reached.
+ */
+static
+read()
+{
+	ferror = 1;
+}
+
+static
+write()
+{
+	ferror = 1;
 }
 
+static
+reset()
+{
+}
+#endif
+
 #if 0	/* XXX - Comment out temporarily. */
 #asm 8080
 ;ALL THE FUNCTIONS IN HERE ARE STATIC TO THIS PACKAGE
@@ -7,6 +7,8 @@ UZI (Unix Z80 Implementation) Kernel:  devio.c
 static int	ok(void);
 static int	nogood(void);
 
+extern void	spin(void);
+
 #include "unix.h"
 #include "extern.h"
 
@@ -16,11 +18,22 @@ void		bawrite(bufptr);
 int		bfree(bufptr, int);
 char *		zerobuf(void);
 void		bufsync(void);
+void		bwriteback(int);
+int		bndirty(int);
+void		bsyncblk(int, blkno_t);
+void		bsyncwait(int);
+void		bufinval(int);
+int		bshift(int);
 void		bufdump(void);
+void		bufinit(void);
 int		cdread(int);
 int		cdwrite(int);
 int		swapread(int, blkno_t, unsigned int, char *);
 int		swapwrite(int, blkno_t, unsigned int, char *);
+int		bdirect(int, blkno_t, unsigned int, int);
+void		bforget(int, blkno_t, unsigned int);
+void		bahead(int, blkno_t);
+void		bdone(bufptr);
 int		d_open(int);
 int		d_close(int);
 int		d_ioctl(int, int, char *);
@@ -32,9 +45,17 @@ int		fullq(struct s_queue *);
 
 static bufptr	bfind(int, blkno_t);
 static bufptr	freebuf(void);
-static void	bufinit(void);
+static void	bqueue(bufptr);
+static int	dqput(bufptr);
+static bufptr	dqnext(int);
+static void	bstart(void);
+static void	bwait(bufptr);
+static void	bdrain(void);
+static void	dsync(void);
 static int	bdread(bufptr);
 static int	bdwrite(bufptr);
+static int	bdio(bufptr, int);
+static void	dseek(int, blkno_t, unsigned int);
 
 /* Buffer pool management. */
 
@@ -44,20 +65,41 @@ bread() is given a device and block number, and a rewrite flag.
 If rewrite is 0, the block is actually read if it is not already
 in the buffer pool. If rewrite is set, it is assumed that the caller
 plans to rewrite the entire contents of the block, and it will
-not be read in, but only have a buffer named after it.
+not be read in, but only have a buffer named after it.  If rewrite
+is 2, the buffer is cleared as well, whether or not it was already
+in the pool; blk_alloc() gets its zeroed blocks this way.
 
 bfree() is given a buffer pointer and a dirty flag.
 If the dirty flag is 0, the buffer is made available for further 
 use.  If the flag is 1, the buffer is marked "dirty", and
 it will eventually be written out to disk.  If the flag is 2,
-it will be immediately written out.
+it will be immediately written out.  If the flag is 3, writing
+it out is started, but not waited for.
 
 zerobuf() returns a buffer of zeroes not belonging to any
 device.  It must be bfree'd after use, and must not be
 dirty. It is used when a read() wants to read an unallocated
 block of a file.
 
-bufsync() write outs all dirty blocks.
+bufsync() write outs all dirty blocks.  bwriteback() starts writing
+out those that have been dirty for WBAGE seconds; it is run by the
+clock, in place of a sync() after every process.  fsync() writes
+only a file's own blocks: it gives each to bsyncblk(), and then
+waits for them with bsyncwait().
+
+Dirty blocks are not written one by one as they are found, but put
+on the disk request queue, which bstart() empties in C-LOOK order:
+upward from where the last transfer left the disk, then back to
+the lowest block queued.  A device with a dev_start routine does
+the transfer on its own and calls bdone() from its interrupt
+routine when it is finished, so one transfer can be in progress
+while the kernel goes on.  Until then the buffer's bf_busy is 2,
+and anyone who wants it must bwait() for it.  bahead() uses this
+to read a block ahead of a reader.
+
+A device's blocks are the size of the blocks of the filesystem
+mounted on it, or 512 bytes if there is none.  bufinval() must be
+called when that changes, so no buffer of the old size is found.
 
 XXX - Note that a pointer to a buffer structure is the
 same as a pointer to the data.  This is very important.
@@ -66,6 +108,19 @@ same as a pointer to the data.  This is very important.
 
 unsigned bufclock = 0;	/* Time-stamp counter for LRU. */
 
+/*
+ * The disk request queue, linked through bf_next, holds buffers
+ * waiting to be written or read, in ascending order of device and
+ * block.  dqdev and dqsec are where the last transfer left the
+ * disk, in 512-byte sectors.
+ */
+static bufptr	dqhead;
+static bufptr	dqcur;		/* The transfer in progress. */
+static int	dqdev;
+static blkno_t	dqsec;
+
+#define dqpos(bp)	((bp)->bf_blk << ((bp)->bf_shift - 9))
+
 char *
 bread(int dev, blkno_t blk, int rewrite)
 {
@@ -73,15 +128,23 @@ bread(int dev, blkno_t blk, int rewrite)
 	bufptr bfind();
 	bufptr freebuf();
 
-	if ((bp = bfind(dev, blk)) != 0) {
+	if ((bp = bfind(dev, blk)) && bp->bf_busy == 2) {
+		bwait(bp);
+		if (bp->bf_dev != dev || bp->bf_blk != blk)
+			bp = NULL;	/* A read ahead failed and dropped it. */
+	}
+	if (bp) {
 		if (bp->bf_busy)
 			panic("want busy block");
+		++kstat.ks_bhit;
 		goto done;
 	}
+	++kstat.ks_bmiss;
 	bp = freebuf();
 
 	bp->bf_dev = dev;
 	bp->bf_blk = blk;
+	bp->bf_shift = bshift(dev);
 
 	/*
 	 * If rewrite is set, we are about to write over the
@@ -93,9 +156,10 @@ bread(int dev, blkno_t blk, int rewrite)
 			return (NULL);
 		}
 
-	if (rewrite == 2)
-		bzero(bp->bf_data, 512);
 done:
+	/* A block found in the pool must be cleared too. */
+	if (rewrite == 2)
+		bzero(bp->bf_data, 1 << bp->bf_shift);
 	bp->bf_busy = 1;
 	bp->bf_time = ++bufclock;	/* Time stamp it. */
 	return (bp->bf_data);
@@ -116,6 +180,8 @@ bawrite(bufptr bp)
 int
 bfree(bufptr bp, int dirty)
 {
+	if (dirty == 1 && !bp->bf_dirty)
+		bp->bf_dtime = wbclock;
 	bp->bf_dirty |= dirty;
 	bp->bf_busy = 0;
 
@@ -125,6 +191,10 @@ bfree(bufptr bp, int dirty)
 		bp->bf_dirty = 0;
 		return (-1);
 	}
+	if (dirty == 3) {
+		bqueue(bp);
+		bstart();
+	}
 	return (0);
 }
 
@@ -136,7 +206,7 @@ zerobuf(void)
 
 	bp = freebuf();
 	bp->bf_dev = -1;
-	bzero(bp->bf_data, 512);
+	bzero(bp->bf_data, MAXBSIZE);
 	return (bp->bf_data);
 }
 
@@ -145,9 +215,132 @@ bufsync(void)
 {
 	bufptr bp;
 
+	for (bp = bufpool; bp < bufpool + NBUFS; ++bp) {
+		if (bp->bf_dev == -1 || !bp->bf_dirty)
+			continue;
+		if (bp->bf_busy) {
+			if (bp->bf_busy == 1)
+				bdwrite(bp);	/* Its user will free it. */
+		} else
+			bqueue(bp);
+	}
+	bstart();
+	bdrain();
+	dsync();
+}
+
+/*
+ * bwriteback starts writing out the buffers that have been dirty
+ * for WBAGE seconds, and does not wait for them.  With drivers set,
+ * the drivers that keep blocks of their own write them out too.
+ */
+void
+bwriteback(int drivers)
+{
+	bufptr bp;
+
 	for (bp = bufpool; bp < bufpool + NBUFS; ++bp)
-		if (bp->bf_dev != -1 && bp->bf_dirty)
-			bdwrite(bp);
+		if (bp->bf_dev != -1 && bp->bf_dirty && !bp->bf_busy &&
+		    (uint16)(wbclock - bp->bf_dtime) >= WBAGE)
+			bqueue(bp);
+	bstart();
+	if (drivers)
+		dsync();
+}
+
+/*
+ * bndirty returns how many of the device's blocks in the pool are
+ * dirty and not yet on their way to the disk.
+ */
+int
+bndirty(int dev)
+{
+	bufptr bp;
+	int n;
+
+	n = 0;
+	for (bp = bufpool; bp < bufpool + NBUFS; ++bp)
+		if (bp->bf_dev == dev && bp->bf_dirty && !bp->bf_busy)
+			++n;
+	return (n);
+}
+
+/*
+ * bsyncblk puts a block of the device on the disk request queue,
+ * if it is in the pool and dirty.  Nothing is started until
+ * bsyncwait().
+ */
+void
+bsyncblk(int dev, blkno_t blk)
+{
+	bufptr bp;
+
+	if (blk && (bp = bfind(dev, blk)) && bp->bf_dirty && !bp->bf_busy)
+		bqueue(bp);
+}
+
+/*
+ * bsyncwait writes out the blocks queued by bsyncblk(), waits for
+ * them, and has the device's driver write out any it keeps itself.
+ */
+void
+bsyncwait(int dev)
+{
+	bstart();
+	bdrain();
+	(*dev_tab[dev].dev_ioctl)(dev_tab[dev].minor, DIOSYNC, NULL);
+}
+
+/*
+ * dsync has the drivers that keep blocks of their own write them out.
+ */
+static void
+dsync(void)
+{
+	int j;
+
+	for (j = 0; j < NDEVS; ++j)
+		(*dev_tab[fsdev(j)].dev_ioctl)(dev_tab[fsdev(j)].minor, DIOSYNC,
+		    NULL);
+}
+
+/*
+ * bufinval writes out the dirty blocks of the given device,
+ * and then forgets all of its blocks.
+ */
+void
+bufinval(int dev)
+{
+	bufptr bp;
+
+	bdrain();
+	for (bp = bufpool; bp < bufpool + NBUFS; ++bp) {
+		if (bp->bf_dev != dev)
+			continue;
+		if (bp->bf_busy)
+			panic("bufinval: busy block");
+		if (bp->bf_dirty)
+			bqueue(bp);
+	}
+	bstart();
+	bdrain();
+	(*dev_tab[dev].dev_ioctl)(dev_tab[dev].minor, DIOSYNC, NULL);
+	for (bp = bufpool; bp < bufpool + NBUFS; ++bp)
+		if (bp->bf_dev == dev)
+			bp->bf_dev = -1;
+}
+
+/*
+ * bshift returns the log2 of the block size of the given device.
+ */
+int
+bshift(int dev)
+{
+	fsptr fp;
+
+	if ((fp = fsof(dev)) && fp->s_mounted)
+		return (fp->s_bshift);
+	return (9);
 }
 
 static bufptr
@@ -171,11 +364,13 @@ freebuf(void)
 	/*
 	 * Try to find a non-busy buffer and
 	 * write out the data if it is dirty.
+	 * If the disk has the oldest, wait for it rather than
+	 * take a newer one.
 	 */
 	oldest = NULL;
 	oldtime = 0;
 	for (bp = bufpool; bp < bufpool + NBUFS; ++bp) {
-		if (bufclock - bp->bf_time >= oldtime && !bp->bf_busy) {
+		if (bufclock - bp->bf_time >= oldtime && bp->bf_busy != 1) {
 			oldest = bp;
 			oldtime = bufclock - bp->bf_time;
 		}
@@ -183,16 +378,217 @@ freebuf(void)
 
 	ifnot (oldest)
 		panic("no free buffers");
-    
+	bwait(oldest);
+
 	if (oldest->bf_dirty) {
-		if (bdwrite(oldest) == -1)
-			udata.u_error = EIO;
-		oldest->bf_dirty = 0;
+		++kstat.ks_bdirty;
+		bqueue(oldest);
+		bstart();
+		bwait(oldest);
 	}
 	return (oldest);
 }
 
+/*
+ * bahead starts reading a block into the pool, if it is not there
+ * and the device can read it without being waited for.
+ */
+void
+bahead(int dev, blkno_t blk)
+{
+	bufptr bp;
+
+	if (dev_tab[dev].dev_start == nogood || bfind(dev, blk))
+		return;
+	bp = freebuf();
+	bp->bf_dev = dev;
+	bp->bf_blk = blk;
+	bp->bf_shift = bshift(dev);
+	bp->bf_time = ++bufclock;
+	bqueue(bp);
+	bstart();
+}
+
+/*
+ * bqueue puts a buffer on the disk request queue, to be written if
+ * it is dirty and read if not.  bdone() takes buffers off the queue
+ * at interrupt level, so interrupts are off while it is looked at.
+ * The transfer is counted here, against the process that wants it,
+ * since it may be started from an interrupt.
+ */
+static void
+bqueue(bufptr bp)
+{
+	int new;
+
+	di();
+	new = dqput(bp);
+	ei();
+	if (new && bp->bf_dirty)
+		++udata.u_ru.ru_oublock;
+	else if (new)
+		++udata.u_ru.ru_inblock;
+}
+
+/*
+ * dqput links a buffer into the queue, in order, and returns 0 if
+ * it was already there.  Interrupts must be off.
+ */
+static int
+dqput(bufptr bp)
+{
+	bufptr *pp;
+
+	bp->bf_busy = 2;
+	for (pp = &dqhead; *pp; pp = &(*pp)->bf_next) {
+		if (*pp == bp)
+			return (0);
+		if ((*pp)->bf_dev > bp->bf_dev || ((*pp)->bf_dev == bp->bf_dev &&
+		    dqpos(*pp) > dqpos(bp)))
+			break;
+	}
+	bp->bf_next = *pp;
+	*pp = bp;
+	return (1);
+}
+
+/*
+ * dqnext takes the next buffer off the queue: the first at or past
+ * the disk's position, or if there is none, the first.  With async
+ * set it takes only buffers of devices with a dev_start routine.
+ * Interrupts must be off.
+ */
+static bufptr
+dqnext(int async)
+{
+	bufptr *pp;
+	bufptr *first;
+	bufptr bp;
+
+	first = NULL;
+	for (pp = &dqhead; *pp; pp = &(*pp)->bf_next) {
+		if (async && dev_tab[(*pp)->bf_dev].dev_start == nogood)
+			continue;
+		ifnot (first)
+			first = pp;
+		if ((*pp)->bf_dev > dqdev || ((*pp)->bf_dev == dqdev &&
+		    dqpos(*pp) >= dqsec))
+			break;
+	}
+	ifnot (*pp)
+		pp = first;
+	ifnot (pp)
+		return (NULL);
+	bp = *pp;
+	*pp = bp->bf_next;
+	return (bp);
+}
+
+/*
+ * bstart works through the queue, unless a transfer is already in
+ * progress.  It returns once it has started a transfer that the
+ * device will finish by itself.  A transfer the device cannot start
+ * that way is done here and waited for, with interrupts on; from
+ * bdone(), at interrupt level, such transfers are left on the queue
+ * for the next bstart() outside it, and ei() leaves interrupts off.
+ * A failed write is marked in bf_error for whoever waits for the
+ * buffer, and a failed read drops the block from the pool.
+ */
+static void
+bstart(void)
+{
+	bufptr bp;
+	devsw *dp;
+	int isr;
+
+	isr = inint;
+	for (;;) {
+		di();
+		if (dqcur || !(bp = dqnext(isr))) {
+			ei();
+			return;
+		}
+		dp = &dev_tab[bp->bf_dev];
+		dseek(bp->bf_dev, dqpos(bp), 1 << bp->bf_shift);
+		if (dp->dev_start != nogood &&
+		    (*dp->dev_start)(dp->minor, bp) == 0) {
+			dqcur = bp;
+			ei();
+			return;
+		}
+		if (isr) {
+			dqput(bp);
+			ei();
+			return;
+		}
+		ei();
+
+		if (bdio(bp, bp->bf_dirty) == -1) {
+			if (bp->bf_dirty)
+				bp->bf_error = 1;
+			else
+				bp->bf_dev = -1;
+		}
+		bp->bf_dirty = 0;
+		bp->bf_busy = 0;
+	}
+}
+
+/*
+ * bdone is called by a device's interrupt routine when the transfer
+ * it was started on is finished.  It starts the next.
+ */
+void
+bdone(bufptr bp)
+{
+	bp->bf_dirty = 0;
+	bp->bf_busy = 0;
+	dqcur = NULL;
+	bstart();
+}
+
+/*
+ * bwait waits until the disk is finished with a buffer, doing any
+ * transfers bdone() left on the queue, and reports a failed write.
+ */
 static void
+bwait(bufptr bp)
+{
+	while (bp->bf_busy == 2) {
+		if (dqcur)
+			spin();
+		else
+			bstart();
+	}
+	if (bp->bf_error) {
+		bp->bf_error = 0;
+		udata.u_error = EIO;
+	}
+}
+
+/*
+ * bdrain waits until the disk request queue is empty, and reports
+ * any write that failed.
+ */
+static void
+bdrain(void)
+{
+	bufptr bp;
+
+	while (dqcur || dqhead) {
+		if (dqcur)
+			spin();
+		else
+			bstart();
+	}
+	for (bp = bufpool; bp < bufpool + NBUFS; ++bp)
+		if (bp->bf_error) {
+			bp->bf_error = 0;
+			udata.u_error = EIO;
+		}
+}
+
+void
 bufinit(void)
 {
 	bufptr bp;
@@ -208,7 +604,7 @@ bufdump(void)
 
 	kprintf("\ndev\tblock\tdirty\tbusy\ttime clock %d\n", bufclock);
 	for (j = bufpool; j < bufpool + NBUFS; ++j)
-		kprintf("%d\t%u\t%d\t%d\t%u\n", j->bf_dev, j->bf_blk,
+		kprintf("%d\t%u\t%d\t%d\t%u\n", j->bf_dev, (unsigned)j->bf_blk,
 		    j->bf_dirty, j->bf_busy, j->bf_time);
 }
 
@@ -226,19 +622,34 @@ udata.u_base, count, and offset have the rest of the data.
 static int
 bdread(bufptr bp)
 {
-	ifnot (validdev(bp->bf_dev))
-		panic("bdread: invalid dev");
-	udata.u_buf = bp;
-	return ((*dev_tab[bp->bf_dev].dev_read)(dev_tab[bp->bf_dev].minor, 0));
+	++udata.u_ru.ru_inblock;
+	return (bdio(bp, 0));
 }
 
 static int
 bdwrite(bufptr bp)
 {
+	++udata.u_ru.ru_oublock;
+	return (bdio(bp, 1));
+}
+
+/*
+ * bdio does the transfer for them, and for bstart(), which has
+ * counted it already.
+ */
+static int
+bdio(bufptr bp, int wr)
+{
+	devsw *dp;
+
 	ifnot (validdev(bp->bf_dev))
-		panic("bdwrite: invalid dev");
+		panic(wr ? "bdwrite: invalid dev" : "bdread: invalid dev");
+	dseek(bp->bf_dev, dqpos(bp), 1 << bp->bf_shift);
 	udata.u_buf = bp;
-	return ((*dev_tab[bp->bf_dev].dev_write)(dev_tab[bp->bf_dev].minor, 0));
+	dp = &dev_tab[bp->bf_dev];
+	if (wr)
+		return ((*dp->dev_write)(dp->minor, 0));
+	return ((*dp->dev_read)(dp->minor, 0));
 }
 
 int
@@ -260,6 +671,7 @@ cdwrite(int dev)
 int
 swapread(int dev, blkno_t blkno, unsigned int nbytes, char *buf)
 {
+	dseek(dev, blkno, nbytes);
 	swapbase = buf;
 	swapcnt = nbytes;
 	swapblk = blkno;
@@ -269,12 +681,85 @@ swapread(int dev, blkno_t blkno, unsigned int nbytes, char *buf)
 int
 swapwrite(int dev, blkno_t blkno, unsigned int nbytes, char *buf)
 {
+	dseek(dev, blkno, nbytes);
 	swapbase = buf;
 	swapcnt = nbytes;
 	swapblk = blkno;
 	return ((*dev_tab[dev].dev_write)(dev_tab[dev].minor, 2));
 }
 
+/*
+ * dseek notes where a transfer of nbytes at sector sec will leave
+ * the disk, for bstart().
+ */
+static void
+dseek(int dev, blkno_t sec, unsigned int nbytes)
+{
+	dqdev = dev;
+	dqsec = sec + (nbytes >> 9);
+}
+
+/*
+ * bforget drops any copies in the pool of n 512-byte blocks of a
+ * device starting at blk, dirty or not, before they are written
+ * around the pool.  It is for the swap devices, whose blocks are
+ * read and written through the pool only for exec()'s arguments.
+ */
+void
+bforget(int dev, blkno_t blk, unsigned int n)
+{
+	bufptr bp;
+
+	for (bp = bufpool; bp < bufpool + NBUFS; ++bp) {
+		if (bp->bf_dev != dev || bp->bf_blk - blk >= n)
+			continue;
+		if (bp->bf_busy == 2)
+			bwait(bp);
+		bp->bf_dev = -1;
+		bp->bf_dirty = 0;
+	}
+}
+
+/*
+ * bdirect reads (wr 0) or writes n whole blocks of a disk, starting
+ * at blk, straight between the disk and udata.u_base in one
+ * command.  The pool is kept coherent with the disk: dirty copies
+ * of the blocks are written out before they are read, and any copy
+ * is forgotten before they are written.
+ */
+int
+bdirect(int dev, blkno_t blk, unsigned int n, int wr)
+{
+	bufptr bp;
+	int sh;
+
+	for (bp = bufpool; bp < bufpool + NBUFS; ++bp) {
+		if (bp->bf_dev != dev || bp->bf_blk - blk >= n)
+			continue;
+		if (bp->bf_busy == 2)
+			bwait(bp);
+		if (bp->bf_busy)
+			panic("bdirect: busy block");
+		if (wr) {
+			bp->bf_dev = -1;
+			bp->bf_dirty = 0;
+		} else if (bp->bf_dirty) {
+			bdwrite(bp);
+			bp->bf_dirty = 0;
+		}
+	}
+
+	sh = bshift(dev);
+	if (wr) {
+		udata.u_ru.ru_oublock += n;
+		swapwrite(dev, blk << (sh - 9), n << sh, udata.u_base);
+	} else {
+		udata.u_ru.ru_inblock += n;
+		swapread(dev, blk << (sh - 9), n << sh, udata.u_base);
+	}
+	return (udata.u_error ? -1 : 0);
+}
+
 /**************************************************
 The device driver read and write routines now have
 only two arguments, minor and rawflag.  If rawflag is
@@ -311,7 +796,8 @@ d_ioctl(int dev, int request, char *data)
 	}
 	if ((*dev_tab[dev].dev_ioctl)(dev_tab[dev].minor,
 	    request, data)) {
-		udata.u_error = EINVAL;
+		ifnot (udata.u_error)	/* The driver may have said why. */
+			udata.u_error = EINVAL;
 		return (-1);
 	}
 	return (0);
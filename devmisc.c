@@ -15,6 +15,17 @@ unsigned int	lpr_write(int, int);
 unsigned int	mem_read(int, int);
 unsigned int	mem_write(int, int);
 unsigned int	null_write(int, int);
+unsigned int	kst_read(int, int);
+int		kt_open(int);
+unsigned int	kt_read(int, int);
+#ifdef KTRACE
+uint32		kt_now(void);
+void		kt_record(void);
+
+static struct ktrec kt_ring[NKTRACE];
+static uint16	kt_wr;		/* Sequence number of the next record, */
+static uint16	kt_rd;		/* and of the next one to be read. */
+#endif
 
 static void	lpout(char);
 
@@ -69,6 +80,107 @@ null_write(int minor, int rawflag)
 	return (udata.u_count);
 }
 
+/*
+ * kst_read reads the kernel's counters, with the offset taken into
+ * struct kstat.  One read of the whole thing is a snapshot.
+ */
+unsigned int
+kst_read(int minor, int rawflag)
+{
+	unsigned int off;
+	unsigned int n;
+
+	if (udata.u_offset.o_blkno)
+		return (0);
+	off = udata.u_offset.o_offset;
+	if (off >= sizeof(struct kstat))
+		return (0);
+	n = sizeof(struct kstat) - off;
+	if (n > udata.u_count)
+		n = udata.u_count;
+	di();
+	bcopy((char *)&kstat + off, udata.u_base, n);
+	ei();
+	return (n);
+}
+
+/*
+ * kt_open fails unless the kernel was built with KTRACE.
+ */
+int
+kt_open(int minor)
+{
+#ifdef KTRACE
+	return (0);
+#else
+	udata.u_error = ENXIO;
+	return (-1);
+#endif
+}
+
+/*
+ * kt_read hands out whole trace records, oldest first, and takes
+ * them out of the ring.  A reader that falls more than NKTRACE
+ * behind loses the oldest; the gap shows in kt_seq.
+ */
+unsigned int
+kt_read(int minor, int rawflag)
+{
+#ifdef KTRACE
+	unsigned int n;
+
+	n = 0;
+	di();
+	if ((uint16)(kt_wr - kt_rd) > NKTRACE)
+		kt_rd = kt_wr - NKTRACE;
+	while (kt_rd != kt_wr && n + sizeof(struct ktrec) <= udata.u_count) {
+		bcopy(&kt_ring[kt_rd % NKTRACE], udata.u_base + n,
+		    sizeof(struct ktrec));
+		n += sizeof(struct ktrec);
+		++kt_rd;
+	}
+	ei();
+	return (n);
+#else
+	return (0);
+#endif
+}
+
+#ifdef KTRACE
+/*
+ * kt_now returns the clock, in ticks.
+ */
+uint32
+kt_now(void)
+{
+	return ((uint32)ticks.t_date * (60 * TICKSPERSEC) + ticks.t_time);
+}
+
+/*
+ * kt_record puts the system call just made into the trace ring.
+ */
+void
+kt_record(void)
+{
+	struct ktrec *kp;
+
+	di();
+	kp = &kt_ring[kt_wr % NKTRACE];
+	kp->kt_seq = kt_wr++;
+	ei();
+	kp->kt_callno = udata.u_callno;
+	kp->kt_error = udata.u_error;
+	kp->kt_pid = udata.u_ptab->p_pid;
+	kp->kt_arg[0] = udata.u_argn3;
+	kp->kt_arg[1] = udata.u_argn2;
+	kp->kt_arg[2] = udata.u_argn1;
+	kp->kt_arg[3] = udata.u_argn;
+	kp->kt_retval = udata.u_retval;
+	kp->kt_start = udata.u_ktstart;
+	kp->kt_end = kt_now();
+}
+#endif
+
 static void
 lpout(char c)
 {
@@ -0,0 +1,128 @@
+/**************************************************
+UZI (Unix Z80 Implementation) Kernel:  devrd.c
+***************************************************/
+
+#include "unix.h"
+#include "extern.h"
+
+/*
+ * RAM disk, in the banked memory beyond the 64K the system runs in.
+ * Minor 0 is a filesystem, for /tmp; minor 1 is the last RDSWAP
+ * blocks, big enough to be a swap device.  Nothing on it survives a
+ * reset, so minor 0 needs a mkfs at boot.
+ */
+/* Its first bank, after the processes' and the swap cache's. */
+#define RDBANK	(PBANK + NBANKS + NSWCACHE)
+
+static struct rdpart {
+	blkno_t	p_base;
+	blkno_t	p_size;
+} rdpart[] = {
+	{ 0, RDBLKS - RDSWAP },
+	{ RDBLKS - RDSWAP, RDSWAP },	/* swap */
+};
+
+#define NRDPART	(sizeof(rdpart) / sizeof(struct rdpart))
+
+int		rd_open(int);
+unsigned int	rd_read(int, int);
+unsigned int	rd_write(int, int);
+
+static unsigned int	rd(int, int, int);
+#ifdef HOSTED
+extern void	rdcopy(uint32, char *, unsigned int, int);
+#else
+static void	rdcopy(uint32, char *, unsigned int, int);
+
+extern void	frombank(int, char *, char *, unsigned int);
+extern void	tobank(int, char *, char *, unsigned int);
+#endif
+
+int
+rd_open(int minor)
+{
+	if (minor >= NRDPART) {
+		udata.u_error = ENXIO;
+		return (-1);
+	}
+	return (0);
+}
+
+unsigned int
+rd_read(int minor, int rawflag)
+{
+	return (rd(minor, rawflag, 0));
+}
+
+unsigned int
+rd_write(int minor, int rawflag)
+{
+	return (rd(minor, rawflag, 1));
+}
+
+/*
+ * rd finds the transfer in the same places as the other block
+ * drivers, and copies it.  Only whole blocks are moved, as wd moves
+ * them, so a raw count is rounded down.  A read past the end reads
+ * nothing.
+ */
+static unsigned int
+rd(int minor, int rawflag, int wr)
+{
+	blkno_t blk;
+	unsigned int n;
+	char *p;
+
+	if (rawflag == 2) {
+		n = swapcnt;
+		p = swapbase;
+		blk = swapblk;
+	} else if (rawflag) {
+		n = udata.u_count;
+		p = udata.u_base;
+		blk = udata.u_offset.o_blkno;
+	} else {
+		n = 1 << udata.u_buf->bf_shift;
+		p = udata.u_buf->bf_data;
+		blk = udata.u_buf->bf_blk << (udata.u_buf->bf_shift - 9);
+	}
+	n &= ~511;
+
+	if (minor >= NRDPART || blk >= rdpart[minor].p_size ||
+	    (n >> 9) > rdpart[minor].p_size - blk) {
+		if (wr)
+			udata.u_error = ENXIO;
+		return (0);
+	}
+	rdcopy((blk + rdpart[minor].p_base) << 9, p, n, wr);
+	return (n);
+}
+
+/* The hosted build supplies an rdcopy() that uses memory of its own. */
+#ifndef HOSTED
+/*
+ * rdcopy moves n bytes between p and byte addr of the RAM disk.  A
+ * bank is switched in over the user's 32K, so bytes for the user
+ * go through a buffer in the kernel's half.  Transfers are in whole
+ * blocks, which never straddle two banks.
+ */
+static void
+rdcopy(uint32 addr, char *p, unsigned int n, int wr)
+{
+	static char bounce[128];
+	char *q;
+	int bank;
+
+	for (; n; n -= 128, addr += 128, p += 128) {
+		bank = RDBANK + (addr >> 15);
+		q = (char *)(addr & 0x7fff);
+		if (wr) {
+			bcopy(p, bounce, 128);
+			tobank(bank, bounce, q, 128);
+		} else {
+			frombank(bank, q, bounce, 128);
+			bcopy(bounce, p, 128);
+		}
+	}
+}
+#endif
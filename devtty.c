@@ -170,12 +170,16 @@ again:
 	goto again;	/* Loop until the uart has no data ready. */
 }
 
-/* XXX - Remove vax specific code */
-#ifdef vax
+#ifdef HOSTED
+/*
+ * In the hosted build the console is stdout.  Carriage returns and
+ * the DEL padding after tabs are only for the real terminal.
+ */
 void
 _putc(char c)
 {
-	write(1, &c, 1);
+	if (c != '\r' && c != '\177')
+		write(1, &c, 1);
 }
 #else
 void
@@ -10,6 +10,10 @@ UZI (Unix Z80 Implementation) Kernel:  devwd.c
 #define WRCMD	0x2a
 
 extern		scsiop();
+extern		scsistart();
+extern		scsiend();
+extern int	scsiint(void);
+extern void	spin(void);
 
 extern char *	dptr;
 extern int	dlen;
@@ -19,25 +23,58 @@ extern int	busid;
 int		wd_open(int);
 char		wd_read(unsigned int, int);
 char		wd_write(unsigned int, int);
+int		wd_start(unsigned int, bufptr);
+int		wd_int(void);
 
-static int	setup(unsigned int, int);
+static int	setup(unsigned int, int, bufptr);
+static void	wdwait(void);
 static void	chkstat(int, int);
 
 static char	cmdblk[10] = { 0, LUN << 5, 0, 0, 0, 0, 0, 0, 0, 0 };
+static bufptr	wdcur;		/* The buffer wd_start() is transferring. */
+
+/*
+ * Partition table.  The minor device number is an index into it.
+ * Each entry gives the starting block and the size of the partition,
+ * both in 512-byte blocks.
+ */
+static struct wdpart {
+	blkno_t	p_base;
+	blkno_t	p_size;
+} wdpart[] = {
+#ifdef HOSTED
+	/* A disk image file has room for bigger partitions. */
+	{ 0x00000, 0x20000 },
+	{ 0x20000, 0x20000 },
+	{ 0x40000, 0x00600 },	/* swap */
+#else
+	{ 0x2b00, 0x0d00 },
+	{ 0x3800, 0x0c00 },
+	{ 0x2500, 0x0600 },	/* swap */
+#endif
+};
+
+#define NWDPART	(sizeof(wdpart) / sizeof(struct wdpart))
 
 int
 wd_open(int minor)
 {
+	if (minor >= NWDPART) {
+		udata.u_error = ENXIO;
+		return (-1);
+	}
 	return (0);
 }
 
 char
 wd_read(unsigned int minor, int rawflag)
 {
+	wdwait();
 	cmdblk[0] = RDCMD;
-	if (setup(minor, rawflag))
+	if (setup(minor, rawflag, udata.u_buf))
 		return (0);
 
+	++kstat.ks_dcmd;
 	chkstat(scsiop(), 1);
 
 	return (cmdblk[8] << 9);
@@ -46,16 +83,65 @@ wd_read(unsigned int minor, int rawflag)
 char
 wd_write(unsigned int minor, int rawflag)
 {
+	wdwait();
 	cmdblk[0] = WRCMD;
-	if (setup(minor, rawflag))
+	if (setup(minor, rawflag, udata.u_buf))
 		return (0);
 
+	++kstat.ks_dcmd;
 	chkstat(scsiop(), 0);
 	return (cmdblk[8] << 9);
 }
 
+/*
+ * wd_start starts the transfer of a buffer, writing it if it is
+ * dirty and reading it if not, and returns without waiting for it.
+ * wd_int() finishes it.
+ */
+int
+wd_start(unsigned int minor, bufptr bp)
+{
+	if (wdcur)
+		return (-1);
+	cmdblk[0] = bp->bf_dirty ? WRCMD : RDCMD;
+	if (setup(minor, 0, bp) || scsistart())
+		return (-1);
+	++kstat.ks_dcmd;
+	wdcur = bp;
+	return (0);
+}
+
+/*
+ * wd_int is the disk's interrupt routine.  The controller interrupts
+ * when a command started by wd_start() wants to send its status.
+ */
+int
+wd_int(void)
+{
+	bufptr bp;
+
+	ifnot (wdcur && scsiint())
+		return (0);
+	bp = wdcur;
+	wdcur = NULL;
+	chkstat(scsiend(), !bp->bf_dirty);
+	bdone(bp);
+	return (1);
+}
+
+/*
+ * wdwait waits until no command is in progress, before one is sent
+ * that is waited for.
+ */
+static void
+wdwait(void)
+{
+	while (wdcur)
+		spin();
+}
+
 static int
-setup(unsigned int minor, int rawflag)
+setup(unsigned int minor, int rawflag, bufptr bp)
 {
 	blkno_t block;
 
@@ -75,21 +161,24 @@ setup(unsigned int minor, int rawflag)
 			block = udata.u_offset.o_blkno;
 		}
 	} else {
-		cmdblk[8] = 1;
-		dlen = 512;
-		dptr = udata.u_buf->bf_data;
-		block = udata.u_buf->bf_blk;
+		cmdblk[8] = 1 << (bp->bf_shift - 9);
+		dlen = 1 << bp->bf_shift;
+		dptr = bp->bf_data;
+		block = bp->bf_blk << (bp->bf_shift - 9);
 	}
 
-	block += (minor & 0xff00);
-	if (block > (minor << 9)) {
+	if (minor >= NWDPART ||
+	    block + (uint16)(cmdblk[8] & 0xff) > wdpart[minor].p_size) {
 		if (cmdblk[0] == WRCMD)
 			udata.u_error = ENXIO;
 		return (1);
 	}
+	block += wdpart[minor].p_base;
 
 	cmdblk[5] = block;
 	cmdblk[4] = block >> 8;
+	cmdblk[3] = block >> 16;
+	cmdblk[2] = block >> 24;
 	return (0);
 }
 
@@ -109,6 +198,8 @@ int	dlen;
 char *	cptr;
 int	busid;
 
+/* The hosted build supplies a scsiop() that uses a disk image file. */
+#ifndef HOSTED
 scsiop()
 {
 #if 0	/* XXX - Comment out temporarily. */
@@ -316,3 +407,179 @@ WRLEN	EQU $ - WRBLK
 #endasm
 #endif
 }
+
+/*
+ * scsistart and scsiend are scsiop cut in two where it waits for the
+ * data to move: scsistart selects the controller, sends the command
+ * and sets the DMA controller going, and scsiend, called once
+ * scsiint says the controller wants to send status, collects it.
+ * Each has its own labels; they share scsiop's SWAIT and WRESET
+ * subroutines and its DMA programs.
+ */
+scsistart()
+{
+#if 0	/* XXX - Comment out temporarily. */
+#asm 8080
+;
+;ENTRY POINT:
+;
+	PUSH	B
+;
+	CALL	SWAIT
+	JZ	SHUNG	;ABORT IF PENDING TRANSACTION
+
+	LDA	busid?	;OUTPUT SCSI BUS ADDRESS
+	OUT	SDATA
+	MVI	A,1	;SELECT CONTROLLER
+	OUT	SCMD	;ASSERT SELECT
+..S2:	IN	SCMD	;WAIT FOR BSY TO BE ASSERTED
+	ANI	01
+	JNZ	..S2
+	XRA	A
+	OUT	SCMD	;DEASSERT IT
+;
+	LHLD	cptr?
+.SLOOP:	CALL	SWAIT	;WAIT FOR REQ
+	JNZ	SLOST
+	IN	SCMD
+	ANI	1FH
+	CPI	01100B	;CONTINUE AS LONG AS IT WANTS COMMANDS
+	JNZ	SCMDE
+	ANI	00100B
+	JZ	SSEQ	;ABORT IF IT HAS A MESSAGE
+	MOV	A,M	;TRANSMIT COMMAND
+	OUT	SDATA
+	INX	H
+	JMP	.SLOOP
+;
+SCMDE:	LHLD	dlen?
+	MOV	A,H
+	ORA	L
+	JZ	SOK	;SKIP DATA I/O IF NECESSARY
+	CALL	SWAIT
+	JNZ	SLOST
+	IN	SCMD	;SEE IF IT REALLY WANTS DATA
+	ANI	10H
+	JZ	SOK
+	IN	SCMD
+	ANI	08H	;CHECK FOR DATA READ OR WRITE
+	JNZ	SWIO
+
+;FILL IN THE DMA PROGRAM WITH THE CORRECT ADDRESS AND LENGTH
+	LHLD	dptr?
+	SHLD	RDADR
+	LHLD	dlen?
+	DCX	H
+	SHLD	RDCNT
+;
+	LXI	H,RDBLK
+	MVI	B,RDLEN
+	MVI	C,DMAPORT
+	OUTIR		;SEND PROGRAM TO DMA CONTROLLER
+	JMP	SOK
+;
+SWIO:
+	LHLD	dptr?
+	SHLD	WRADR
+	LHLD	dlen?
+	DCX	H
+	SHLD	WRCNT
+;
+	LXI	H,WRBLK
+	MVI	B,WRLEN
+	MVI	C,DMAPORT
+	OUTIR		;SEND PROGRAM TO DMA CONTROLLER
+;
+;THE DATA MOVES BY DMA; scsiend COLLECTS THE STATUS.
+;
+SOK:	LXI	H,0
+;
+SDONE:	POP	B
+	MOV	A,H
+	ORA	L
+	RET
+;
+SLOST:	LXI	H,-1
+	JMP	SDONE
+;
+SSEQ:	CALL	SWAIT
+	LXI	H,-2
+	JNZ	SDONE
+	IN	SDATA	;EAT EXTRA DATA
+	JMP	SSEQ
+;
+SHUNG:
+	CALL	WRESET
+	LXI	H,-3
+	JMP	SDONE
+#endasm
+#endif
+}
+
+scsiend()
+{
+#if 0	/* XXX - Comment out temporarily. */
+#asm 8080
+;
+;ENTRY POINT:
+;
+	PUSH	B
+;
+EWAIT:
+	CALL	SWAIT	;WAIT UNTIL THE CONTROLLER WANTS TO SEND NON-DATA
+	JNZ	ELOST
+	IN	SCMD
+	ANI	10H
+	JNZ	EWAIT
+;
+;GET STATUS AND SHUT DOWN
+;
+	MVI	A,0A3H
+	OUT	DMAPORT	;TURN OFF DMA CONTROLLER
+
+	IN	SCMD
+	ANI	1FH
+	CPI	00100B
+	JNZ	ESEQ	;JUMP IF IT DOES NOT WANT TO SEND STATUS
+;
+	IN	SDATA
+	MOV	L,A
+	MVI	H,0
+	CALL	SWAIT
+	JNZ	ELOST
+	IN	SCMD
+	ANI	1FH
+	CPI	00000B
+	JNZ	ESEQ
+	IN	SDATA	;READ FINAL MESSAGE BYTE
+;
+EDONE:	POP	B
+	MOV	A,H
+	ORA	L
+	RET
+;
+ELOST:	LXI	H,-1
+	JMP	EDONE
+;
+ESEQ:	CALL	SWAIT
+	LXI	H,-2
+	JNZ	EDONE
+	IN	SDATA	;EAT EXTRA DATA
+	JMP	ESEQ
+#endasm
+#endif
+}
+
+/*
+ * scsiint says whether the controller is asking to send status: it
+ * is busy, REQ is asserted, and the phase is status.
+ */
+int
+scsiint(void)
+{
+	int s;
+
+	s = in(0xd9);
+	return ((s & 0x23) == 0 && (s & 0x1f) == 0x04);
+}
+#endif /* HOSTED */
@@ -45,7 +45,11 @@ int	__exit(),
 	_kill(),
 	_pipe(),
 	_getgid(),
-	_times();
+	_times(),
+	_lseek(),
+	_profil(),
+	_getrusage(),
+	_fsync();
 
 int (*disp_tab[])() = {
 	__exit,
@@ -90,7 +94,11 @@ int (*disp_tab[])() = {
 	_kill,
 	_pipe,
 	_getgid,
-	_times
+	_times,
+	_lseek,
+	_profil,
+	_getrusage,
+	_fsync
 };
 
 char dtsize = sizeof(disp_tab) / sizeof(int(*)()) - 1;
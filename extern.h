@@ -25,6 +25,7 @@ extern int16 inint;	/* Flag is set whenever interrupts are being serviced. */
 
 extern int16 sec;	/* Tick counter for counting off one second. */
 extern int16 runticks;	/* Number of ticks current process has been swapped in. */
+extern uint16 wbclock;	/* Seconds, counted for the writeback timer. */
 
 extern time_t tod;	/* Time of day. */
 extern time_t ticks;	/* Cumulative tick counter, in minutes and ticks. */
@@ -34,6 +35,9 @@ extern unsigned swapcnt;
 extern blkno_t swapblk;
 
 extern char vector[3];	/* Place for interrupt vector. */
+extern char ubank;	/* Bank mapped at 0..0x7fff for the running process. */
+
+extern struct kstat kstat;	/* Counters for /dev/kstat. */
 
 #ifdef MAIN
 #undef extern
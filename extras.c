@@ -5,7 +5,32 @@ UZI (Unix Z80 Implementation) Kernel:  extras.c
 void	bcopy(const void *, void *, int);
 void	bzero(void *, int);
 void 	abort(void);
+int	zpack(char **, char *, char *, int);
+char *	zunpack(char *, int, char *, char *);
 
+#ifdef HOSTED
+/*
+ * The hosted build uses the host's own copying and abort().
+ * bzero() can not be a bcopy() onto itself there, as memmove() does
+ * not smear the first byte along the way LDIR does.  The bytes are
+ * counted for the benchmarks.
+ */
+extern long	hk_bytes;
+
+void
+bcopy(const void *src, void *dest, int count)
+{
+	hk_bytes += count;
+	__builtin_memmove(dest, src, count);
+}
+
+void
+bzero(void *ptr, int count)
+{
+	hk_bytes += count;
+	__builtin_memset(ptr, 0, count);
+}
+#else
 void
 bcopy(const void *src, void *dest, int count)
 {
@@ -49,8 +74,10 @@ BCHLDR:	DS	2
 void
 bzero(void *ptr, int count)
 {
-	ptr = 0;
-	bcopy(ptr, ptr + 1, count - 1);
+	if (count <= 0)
+		return;
+	*(char *)ptr = 0;
+	bcopy(ptr, (char *)ptr + 1, count - 1);
 }
 
 void
@@ -63,3 +90,65 @@ abort(void)
 #endasm
 #endif
 }
+#endif
+
+/*
+ * zpack run-length encodes the bytes from *src up to end into at
+ * most n bytes at out, advancing *src past those it took, and
+ * returns the number of bytes put out.  A code byte c below 0x80 is
+ * followed by c + 1 bytes as they are; one from 0x80 up by a byte
+ * to be repeated c - 0x80 + 3 times.  A code is never split
+ * between two calls, so each n bytes put out unpack on their own.
+ */
+int
+zpack(char **src, char *end, char *out, int n)
+{
+	char *p, *q, *o;
+
+	p = *src;
+	o = out;
+	while (p < end && o + 2 <= out + n) {
+		for (q = p + 1; q < end && *q == *p && q - p < 130; ++q)
+			;
+		if (q - p >= 3) {
+			*o++ = 0x80 + (q - p - 3);
+			*o++ = *p;
+			p = q;
+			continue;
+		}
+		/* As they are, up to the next run of three. */
+		for (q = p; q < end && q - p < 128 && q - p < out + n - o - 1;
+		    ++q)
+			if (q + 2 < end && q[0] == q[1] && q[0] == q[2])
+				break;
+		*o++ = q - p - 1;
+		while (p < q)
+			*o++ = *p++;
+	}
+	*src = p;
+	return (o - out);
+}
+
+/*
+ * zunpack unpacks the codes in the n bytes at in to dst, stopping
+ * at end, and returns where it stopped.  A byte left over at the
+ * end of the n is not a code.
+ */
+char *
+zunpack(char *in, int n, char *dst, char *end)
+{
+	char *e;
+	int c;
+
+	for (e = in + n; in + 1 < e && dst < end; ) {
+		c = *in++ & 0xff;
+		if (c & 0x80) {
+			for (c = c - 0x80 + 3; c-- && dst < end; )
+				*dst++ = *in;
+			++in;
+		} else
+			for (++c; c-- && dst < end && in < e; )
+				*dst++ = *in++;
+	}
+	return (dst);
+}
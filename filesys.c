@@ -24,13 +24,17 @@ void			wr_inode(inoptr);
 int			isdevice(inoptr);
 int			devnum(inoptr);
 void			f_trunc(inoptr);
+void			f_sync(inoptr);
 blkno_t			bmap(inoptr, blkno_t, int);
+int			data_next(inoptr, blkno_t);
 inoptr			getinode(int);
 int			super(void);
 int			getperm(inoptr);
 void			setftime(inoptr, int);
+int			rdonly(inoptr);
 int			getmode(inoptr);
 int			fmount(int, inoptr);
+void			wr_super(int);
 
 static inoptr		srch_dir(inoptr, char *);
 static inoptr		srch_mt(inoptr);
@@ -41,9 +45,20 @@ static unsigned int	i_alloc(int);
 static void		i_free(int, unsigned int);
 static blkno_t		blk_alloc(int);
 static void		blk_free(int, blkno_t);
-static void		freeblk(int, blkno_t, int);
+static void		freeind(int, blkno_t, int);
+static void		syncind(int, blkno_t, int);
+static void		fb_add(int, blkno_t);
+static void		fb_flush(int);
 static void		validblk(int, blkno_t);
 static void		magic(inoptr);
+static void		rd_dinode(fsptr, char *, int, dinode *);
+static void		wr_dinode(fsptr, char *, int, dinode *);
+static blkno_t		getind(fsptr, char *, int);
+static void		setind(fsptr, char *, int, blkno_t);
+static void		setext(inoptr, blkno_t, blkno_t, int);
+static blkno_t		data_alloc(inoptr, blkno_t, int);
+static void		prealloc(inoptr, blkno_t);
+static void		prerelease(inoptr);
 
 /*
  * n_open is given a string containing a path name,
@@ -98,7 +113,7 @@ n_open(char *name, inoptr *parent)
 
 		/* See if we are going up through a mount point. */
 		if ( wd->c_num == ROOTINODE && wd->c_dev != ROOTDEV && name[1] == '.') {
-			temp = fs_tab[wd->c_dev].s_mntpt;
+			temp = fsof(wd->c_dev)->s_mntpt;
 			++temp->c_refs;
 			i_deref(wd);
 			wd = temp;
@@ -139,21 +154,25 @@ srch_dir(inoptr wd, char *compname)
 	int curentry;
 	blkno_t curblock;
 	struct direct *buf;
-	int nblocks;
+	blkno_t nblocks;
+	int sh;
 	unsigned inum;
 	inoptr i_open();
 	blkno_t bmap();
 
+	/* Count 512-byte blocks, then round up to filesystem blocks. */
+	sh = fsof(wd->c_dev)->s_bshift - 9;
 	nblocks = wd->c_node.i_size.o_blkno;
 	if (wd->c_node.i_size.o_offset)
 		++nblocks;
+	nblocks = (nblocks + (1 << sh) - 1) >> sh;
 
 	for (curblock = 0; curblock < nblocks; ++curblock) {
 		buf = (struct direct *)bread( wd->c_dev,
 		    bmap(wd, curblock, 1), 0);
-		for (curentry = 0; curentry < 32; ++curentry) {
+		for (curentry = 0; curentry < (32 << sh); ++curentry) {
 			if (namecomp(compname, buf[curentry].d_name)) {
-				inum = buf[curentry&0x1f].d_ino;
+				inum = buf[curentry].d_ino;
 				brelse(buf);
 				return (i_open(wd->c_dev, inum));
 			}
@@ -178,7 +197,7 @@ srch_mt(inoptr ino)
 		if (fs_tab[j].s_mounted == SMOUNTED &&
 		    fs_tab[j].s_mntpt == ino) {
 			i_deref(ino);
-			return (i_open(j, ROOTINODE));
+			return (i_open(fsdev(j), ROOTINODE));
 		}
 	}
 	return (ino);
@@ -193,17 +212,18 @@ srch_mt(inoptr ino)
 inoptr
 i_open(int dev, unsigned int ino)
 {
-	struct dinode *buf;
+	char *buf;
+	fsptr fp;
 	inoptr nindex;
 	int i;
 	inoptr j;
 	int new;
-	static nexti;
+	static inoptr nexti;
 	unsigned i_alloc();
 
 	nexti = i_tab;
 
-	if (dev < 0 || dev >= NDEVS)
+	ifnot (fp = fsof(dev))
 		panic("i_open: Bad dev");
 
 	new = 0;
@@ -215,7 +235,8 @@ i_open(int dev, unsigned int ino)
 		}
 	}
 
-	if (ino < ROOTINODE || ino >= (fs_tab[dev].s_isize - 2) * 8) {
+	if (ino < ROOTINODE ||
+	    ino >= (unsigned)(fp->s_isize - fp->s_ifirst) << fp->s_inoshift) {
 		warning("i_open: bad inode number");
 		return (NULLINODE);
 	}
@@ -232,6 +253,7 @@ i_open(int dev, unsigned int ino)
 
 		if (j->c_dev == dev && j->c_num == ino) {
 			nindex = j;
+			++kstat.ks_ihit;
 			goto found;
 		}
 	}
@@ -242,13 +264,17 @@ i_open(int dev, unsigned int ino)
 		return (NULLINODE);
 	}
 
-	buf = (struct dinode *)bread(dev, (ino>>3) + 2, 0);
-	bcopy((char *)&(buf[ino & 0x07]), (char *)&(nindex->c_node), 64);
+	++kstat.ks_imiss;
+	buf = bread(dev, (ino >> fp->s_inoshift) + fp->s_ifirst, 0);
+	rd_dinode(fp, buf, ino & ((1 << fp->s_inoshift) - 1),
+	    &nindex->c_node);
 	brelse(buf);
 
 	nindex->c_dev = dev;
 	nindex->c_num = ino;
 	nindex->c_magic = CMAGIC;
+	nindex->c_elen = 0;
+	nindex->c_palen = 0;
 found:
 	if (new) {
 		if (nindex->c_node.i_nlink || nindex->c_node.i_mode & F_MASK)
@@ -278,6 +304,7 @@ int
 ch_link(inoptr wd, char *oldname, char *newname, inoptr nindex)
 {
 	struct direct curentry;
+	int j;
 
 	ifnot (getperm(wd) & OTH_WR) {
 		udata.u_error = EPERM;
@@ -302,7 +329,9 @@ ch_link(inoptr wd, char *oldname, char *newname, inoptr nindex)
 	if (udata.u_count == 0 && *oldname)
 		return (0);	/* Entry not found. */
 
-	bcopy(newname, curentry.d_name, 14);
+	/* Copy the name, padded with nulls; it may be shorter than 14. */
+	for (j = 0; j < 14; ++j)
+		curentry.d_name[j] = *newname ? *newname++ : '\0';
 	if (nindex)
 		curentry.d_ino = nindex->c_num;
 	else
@@ -422,8 +451,8 @@ getdev(int devno)
 {
 	fsptr dev;
 
-	dev = fs_tab + devno;
-	if (devno < 0 || devno >= NDEVS || !dev->s_mounted)
+	dev = fsof(devno);
+	if (!dev || !dev->s_mounted)
 		panic("getdev: bad dev");
 	rdtime(&(dev->s_time));
 	dev->s_fmod = 1;
@@ -448,9 +477,11 @@ i_alloc(int devno)
 {
 	fsptr dev;
 	blkno_t blk;
-	struct dinode *buf;
+	char *buf;
+	struct d7inode *dp;
 	int j;
 	int k;
+	int isz;
 	unsigned int ino;
 
 	if (baddev(dev = getdev(devno)))
@@ -460,7 +491,8 @@ tryagain:
 		ifnot (dev->s_tinode)
 			goto corrupt;
 		ino = dev->s_inode[--dev->s_ninode];
-		if (ino < 2 || ino >= (dev->s_isize - 2) * 8)
+		if (ino < 2 || ino >=
+		    (unsigned)(dev->s_isize - dev->s_ifirst) << dev->s_inoshift)
 			goto corrupt;
 		--dev->s_tinode;
 		return (ino);
@@ -469,11 +501,16 @@ tryagain:
 	/* We must scan the inodes, and fill up the table. */
 	_sync();	/* Make on-disk inodes consistent. */
 	k = 0;
-	for (blk = 2; blk < dev->s_isize; blk++) {
-		buf = (struct dinode *)bread(devno, blk, 0);
-		for (j = 0; j < 8; j++) {
-			ifnot (buf[j].i_mode || buf[j].i_nlink)
-				dev->s_inode[k++] = 8 * (blk - 2) + j;
+	isz = dev->s_fstype == FS_V7 ? sizeof(struct d7inode) :
+	    sizeof(struct d32inode);
+	for (blk = dev->s_ifirst; blk < dev->s_isize; blk++) {
+		buf = bread(devno, blk, 0);
+		for (j = 0; j < (1 << dev->s_inoshift); j++) {
+			/* Mode and link count lead both inode formats. */
+			dp = (struct d7inode *)(buf + j * isz);
+			ifnot (dp->i_mode || dp->i_nlink)
+				dev->s_inode[k++] =
+				    ((blk - dev->s_ifirst) << dev->s_inoshift) + j;
 			if (k == 50) {
 				brelse(buf);
 				goto done;
@@ -511,7 +548,8 @@ i_free(int devno, unsigned int ino)
 	if (baddev(dev = getdev(devno)))
 		return;
 
-	if (ino < 2 || ino >= (dev->s_isize - 2) * 8)
+	if (ino < 2 || ino >=
+	    (unsigned)(dev->s_isize - dev->s_ifirst) << dev->s_inoshift)
 		panic("i_free: bad ino");
 
 	++dev->s_tinode;
@@ -528,7 +566,7 @@ blk_alloc(int devno)
 {
 	fsptr dev;
 	blkno_t newno;
-	blkno_t *buf;
+	char *buf;
 	int j;
 
 	if (baddev(dev = getdev(devno)))
@@ -548,11 +586,12 @@ blk_alloc(int devno)
 
 	/* See if we must refill the s_free array. */
 	ifnot (dev->s_nfree) {
-		buf = (blkno_t *)bread(devno, newno, 0);
-		dev->s_nfree = buf[0];
+		buf = bread(devno, newno, 0);
+		dev->s_nfree = *(int16 *)buf;
+		/* The list follows the count, one indirect-sized entry in. */
 		for (j = 0; j < 50; j++)
-			dev->s_free[j] = buf[j + 1];
-		brelse((char *)buf);
+			dev->s_free[j] = getind(dev, buf, j + 1);
+		brelse(buf);
 	}
 
 	validblk(devno, newno);
@@ -561,9 +600,8 @@ blk_alloc(int devno)
 		goto corrupt;
 	--dev->s_tfree;
 
-	/* Zero out the new block. */
-	buf = (blkno_t *)bread(devno, newno, 2);
-	bzero(buf, 512);
+	/* Zero out the new block, which bread() does even if it is cached. */
+	buf = bread(devno, newno, 2);
 	bawrite(buf);
 	return (newno);
 corrupt:
@@ -583,6 +621,7 @@ blk_free(int devno, blkno_t blk)
 {
 	fsptr dev;
 	char *buf;
+	int j;
 
 	ifnot (blk)
 		return;
@@ -593,8 +632,10 @@ blk_free(int devno, blkno_t blk)
 	validblk(devno, blk);
 
 	if (dev->s_nfree == 50) {
-		buf = bread(devno, blk, 1);
-		bcopy((char *)&(dev->s_nfree), buf, 512);
+		buf = bread(devno, blk, 2);
+		*(int16 *)buf = dev->s_nfree;
+		for (j = 0; j < 50; j++)
+			setind(dev, buf, j + 1, dev->s_free[j]);
 		bawrite(buf);
 		dev->s_nfree = 0;
 	}
@@ -689,6 +730,10 @@ i_deref(inoptr ino)
 	ifnot (--ino->c_refs || ino->c_node.i_nlink)
 		f_trunc(ino);
 
+	/* Give back any blocks reserved for appending to the file. */
+	if (!(ino->c_refs) && ino->c_palen)
+		prerelease(ino);
+
 	/* If the inode was modified, we must write it to disk. */
 	if (!(ino->c_refs) && ino->c_dirty) {
 		ifnot (ino->c_node.i_nlink) {
@@ -701,21 +746,27 @@ i_deref(inoptr ino)
 
 /*
  * wr_inode writes out the given inode in the inode table out to disk,
- * and resets its dirty bit.
+ * and resets its dirty bit.  One on a read-only filesystem is never
+ * written.
  */
 void
 wr_inode(inoptr ino)
 {
-	struct dinode *buf;
-	blkno_t blkno;
+	char *buf;
+	fsptr fp;
 
 	magic(ino);
 
-	blkno = (ino->c_num >> 3) + 2;
-	buf = (struct dinode *)bread(ino->c_dev, blkno, 0);
-	bcopy((char *)(&ino->c_node),
-	    (char *)((char **)&buf[ino->c_num & 0x07]), 64);
-	bfree(buf, 2);
+	fp = fsof(ino->c_dev);
+	if (fp->s_flags & MNT_RDONLY) {
+		ino->c_dirty = 0;
+		return;
+	}
+	buf = bread(ino->c_dev,
+	    (ino->c_num >> fp->s_inoshift) + fp->s_ifirst, 0);
+	wr_dinode(fp, buf, ino->c_num & ((1 << fp->s_inoshift) - 1),
+	    &ino->c_node);
+	bfree(buf, 1);
 	ino->c_dirty = 0;
 }
 
@@ -746,20 +797,23 @@ f_trunc(inoptr ino)
 {
 	int dev;
 	int j;
+	int ndirect;
 
 	dev = ino->c_dev;
+	ndirect = 20 - fsof(dev)->s_nlevels;
+	prerelease(ino);
 
-	/* First deallocate the double indirect blocks. */
-	freeblk(dev, ino->c_node.i_addr[19], 2);
-
-	/* Also deallocate the indirect blocks. */
-	freeblk(dev, ino->c_node.i_addr[18], 1);
+	/* First deallocate the indirect blocks, deepest first. */
+	for (j = 19; j >= ndirect; --j)
+		freeind(dev, ino->c_node.i_addr[j], j - ndirect + 1);
 
 	/* Finally, free the direct blocks. */
-	for (j = 17; j >= 0; --j)
-		freeblk(dev, ino->c_node.i_addr[j], 0);
+	for (j = ndirect - 1; j >= 0; --j)
+		fb_add(dev, ino->c_node.i_addr[j]);
+	fb_flush(dev);
 
 	bzero((char *)ino->c_node.i_addr, sizeof(ino->c_node.i_addr));
+	ino->c_elen = 0;
 
 	ino->c_dirty = 1;
 	ino->c_node.i_size.o_blkno = 0;
@@ -767,25 +821,184 @@ f_trunc(inoptr ino)
 }
 
 /*
- * Companion function to f_trunc().
+ * f_sync writes out the file's own dirty blocks, for fsync(): its
+ * data blocks, its indirect blocks, and the block its inode is in.
+ * The inode's block and the direct blocks are queued first.  The
+ * walk of the indirect blocks starts, and goes on, only while some
+ * of the device's blocks in the pool are left dirty, so a big file's
+ * indirect blocks are read only while there is something to find.
  */
 void
-freeblk(int dev, blkno_t blk, int level)
+f_sync(inoptr ino)
+{
+	int dev;
+	int j;
+	int ndirect;
+	fsptr fp;
+
+	dev = ino->c_dev;
+	fp = fsof(dev);
+	if (ino->c_dirty)
+		wr_inode(ino);
+	bsyncblk(dev, (ino->c_num >> fp->s_inoshift) + fp->s_ifirst);
+	if (getmode(ino) == F_REG || getmode(ino) == F_DIR) {
+		ndirect = 20 - fp->s_nlevels;
+		for (j = 0; j < ndirect; ++j)
+			bsyncblk(dev, ino->c_node.i_addr[j]);
+
+		/* Read no indirect block unless something is left to find. */
+		if (bndirty(dev))
+			for (j = ndirect; j < 20; ++j)
+				syncind(dev, ino->c_node.i_addr[j],
+				    j - ndirect + 1);
+	}
+	bsyncwait(dev);
+}
+
+/*
+ * Companion function to f_sync().  syncind queues the dirty blocks
+ * under the indirect block blk, of the given level, and blk itself.
+ * It walks the tree as freeind() does.
+ */
+static void
+syncind(int dev, blkno_t blk, int level)
 {
-	blkno_t *buf;
+	blkno_t stk[3];
+	int idx[3];
+	blkno_t nb;
+	char *buf;
+	fsptr fp;
+	int d;
 	int j;
 
 	ifnot (blk)
 		return;
 
-	if (level) {
-		buf = (blkno_t *)bread(dev, blk, 0);
-		for (j = 255; j >= 0; --j)
-			freeblk(dev, buf[j], level - 1);
-		brelse((char *)buf);
+	fp = fsof(dev);
+	d = 0;
+	stk[0] = blk;
+	idx[0] = 1 << fp->s_indshift;
+	while (d >= 0) {
+		ifnot (bndirty(dev))
+			return;
+		buf = bread(dev, stk[d], 0);
+		if (level - d == 1) {
+			for (j = 0; j < (1 << fp->s_indshift); ++j)
+				bsyncblk(dev, getind(fp, buf, j));
+			brelse(buf);
+			bsyncblk(dev, stk[d--]);
+			continue;
+		}
+
+		nb = 0;
+		while (idx[d] > 0 && !(nb = getind(fp, buf, --idx[d])))
+			;
+		brelse(buf);
+		if (nb) {
+			stk[++d] = nb;
+			idx[d] = 1 << fp->s_indshift;
+		} else
+			bsyncblk(dev, stk[d--]);
 	}
+}
+
+/*
+ * Blocks being freed by f_trunc() are batched here, so they can
+ * be given back to the free list in order.
+ */
+static blkno_t	fb_list[NFREEBATCH];
+static int	fb_n;
 
-	blk_free(dev, blk);
+/*
+ * Companion function to f_trunc().  freeind frees the indirect
+ * block blk, of the given level, and everything below it.  It walks
+ * the tree with a stack of its own rather than by recursion, and
+ * holds no buffer while blocks are being freed.
+ */
+void
+freeind(int dev, blkno_t blk, int level)
+{
+	blkno_t stk[3];
+	int idx[3];
+	blkno_t nb;
+	char *buf;
+	fsptr fp;
+	int d;
+	int j;
+
+	ifnot (blk)
+		return;
+
+	fp = fsof(dev);
+	d = 0;
+	stk[0] = blk;
+	idx[0] = 1 << fp->s_indshift;
+	while (d >= 0) {
+		buf = bread(dev, stk[d], 0);
+		if (level - d == 1) {
+			/* The bottom level points only at data blocks. */
+			for (j = (1 << fp->s_indshift) - 1; j >= 0; --j) {
+				ifnot (nb = getind(fp, buf, j))
+					continue;
+				if (fb_n == NFREEBATCH) {
+					brelse(buf);
+					fb_flush(dev);
+					buf = bread(dev, stk[d], 0);
+				}
+				fb_list[fb_n++] = nb;
+			}
+			brelse(buf);
+			fb_add(dev, stk[d--]);
+			continue;
+		}
+
+		/* Descend into the next indirect block, if any are left. */
+		nb = 0;
+		while (idx[d] > 0 && !(nb = getind(fp, buf, --idx[d])))
+			;
+		brelse(buf);
+		if (nb) {
+			stk[++d] = nb;
+			idx[d] = 1 << fp->s_indshift;
+		} else
+			fb_add(dev, stk[d--]);
+	}
+}
+
+/*
+ * fb_add adds a block to the batch being freed.
+ */
+void
+fb_add(int dev, blkno_t blk)
+{
+	ifnot (blk)
+		return;
+	if (fb_n == NFREEBATCH)
+		fb_flush(dev);
+	fb_list[fb_n++] = blk;
+}
+
+/*
+ * fb_flush frees the batched blocks, highest first.  The free list
+ * then hands them out again in ascending order, and the free-list
+ * blocks it fills are spilled in block order.
+ */
+void
+fb_flush(int dev)
+{
+	blkno_t t;
+	int j;
+	int k;
+
+	for (j = 1; j < fb_n; ++j) {
+		t = fb_list[j];
+		for (k = j; k > 0 && fb_list[k - 1] < t; --k)
+			fb_list[k] = fb_list[k - 1];
+		fb_list[k] = t;
+	}
+	for (j = 0; j < fb_n; ++j)
+		blk_free(dev, fb_list[j]);
+	fb_n = 0;
 }
 
 /* XXX - Changes: blk_alloc zeroes block it allocates */
@@ -794,89 +1007,234 @@ freeblk(int dev, blkno_t blk, int level)
  * bmap defines the structure of file system storage by
  * returning the physical block number on a device given
  * the inode and the logical block number in a file.
- * The block is zeroed if created.
+ * The block is zeroed if created, unless rwflg is 2, which says the
+ * caller is about to write all of it.
+ * The last run of physically contiguous blocks found is kept in
+ * the inode, so sequential access need not read the indirect
+ * blocks again.
  */
 blkno_t
 bmap(inoptr ip, blkno_t bn, int rwflg)
 {
 	int i;
-	bufptr bp;
+	char *bp;
 	int j;
+	int k;
 	blkno_t nb;
+	blkno_t lbn;
+	blkno_t span;
 	int sh;
+	int ndirect;
 	int dev;
+	fsptr fp;
 
 	blkno_t blk_alloc();
 
 	if (getmode(ip) == F_BDEV)
 		return (bn);
 
+	/* See if the block is in the cached extent. */
+	if (bn - ip->c_elblk < ip->c_elen)
+		return (ip->c_epblk + (bn - ip->c_elblk));
+	lbn = bn;
+
 	dev = ip->c_dev;
+	fp = fsof(dev);
+	ndirect = 20 - fp->s_nlevels;
 
-	/* Blocks 0..17 are direct blocks. */
-	if (bn < 18) {
+	/* The first ndirect addresses are direct blocks. */
+	if (bn < ndirect) {
 		nb = ip->c_node.i_addr[bn];
 		if (nb == 0) {
-			if (rwflg || (nb = blk_alloc(dev)) == 0)
+			if (rwflg == 1 || (nb = data_alloc(ip, lbn, rwflg)) == 0)
 				return (NULLBLK);
 			ip->c_node.i_addr[bn] = nb;
 			ip->c_dirty = 1;
 		}
+		for (k = 1; bn + k < ndirect &&
+		    ip->c_node.i_addr[bn + k] == nb + k; ++k)
+			;
+		setext(ip, lbn, nb, k);
 		return (nb);
 	}
 
 	/*
-	 * Addresses 18 and 19 have single and double indirect blocks.
+	 * The remaining addresses are single, double (and, for a
+	 * 32-bit filesystem, triple) indirect blocks.
 	 * The first step is to determine how many levels of indirection.
 	 */
-	bn -= 18;
-	sh = 0;
-	j = 2;
-	/* bn > 255  so double indirect. */
-	if (bn & 0xff00) {
-		sh = 8;
-		bn -= 256;
-		j = 1;
+	bn -= ndirect;
+	span = (blkno_t)1 << fp->s_indshift;
+	for (j = 1; bn >= span; ++j) {
+		if (j == fp->s_nlevels)
+			return (NULLBLK);	/* Past the end of the map. */
+		bn -= span;
+		span <<= fp->s_indshift;
 	}
 
 	/*
 	 * Fetch the address from the inode.
 	 * Create the first indirect block if needed.
 	 */
-	ifnot (nb = ip->c_node.i_addr[20 - j]) {
-		if(rwflg || !(nb = blk_alloc(dev)))
+	ifnot (nb = ip->c_node.i_addr[ndirect + j - 1]) {
+		if(rwflg == 1 || !(nb = blk_alloc(dev)))
 			return (NULLBLK);
-		ip->c_node.i_addr[20 - j] = nb;
+		ip->c_node.i_addr[ndirect + j - 1] = nb;
 		ip->c_dirty = 1;
 	}
 
 	/*
 	 * Fetch through the indirect blocks.
 	 */
-	for (; j <= 2; j++) {
-		bp = (bufptr)bread(dev, nb, 0);
+	for (sh = (j - 1) * fp->s_indshift; j > 0; --j) {
+		bp = bread(dev, nb, 0);
 		/****** XXX - Why is this commented out
 		if(bp->bf_error) {
 			brelse(bp);
 			return ((blkno_t)0);
 		}
 	        ******/
-		i = (bn >> sh) & 0xff;
-		if (nb = ((blkno_t *)bp)[i])
+		i = (bn >> sh) & ((1 << fp->s_indshift) - 1);
+		k = 1;
+		if (nb = getind(fp, bp, i)) {
+			/* In the last block, see how far the run goes. */
+			if (j == 1)
+				while (i + k < (1 << fp->s_indshift) &&
+				    getind(fp, bp, i + k) == nb + k)
+					++k;
 			brelse(bp);
-		else {
-			if(rwflg || !(nb = blk_alloc(dev))) {
+		} else {
+			if (rwflg == 1 || !(nb = j == 1 ?
+			    data_alloc(ip, lbn, rwflg) : blk_alloc(dev))) {
 				brelse(bp);
 				return (NULLBLK);
 			}
-			((blkno_t *)bp)[i] = nb;
+			setind(fp, bp, i, nb);
 			bawrite(bp);
 		}
-		sh -= 8;
+		sh -= fp->s_indshift;
 	}
+	setext(ip, lbn, nb, k);
 	return (nb);
 }
 
+/*
+ * data_alloc allocates the data block for logical block lbn.
+ * If the file is being appended to, it takes the block just after
+ * the previous one from the inode's reservation, reserving a fresh
+ * run from the free list when the old one does not fit.  Such a
+ * block is zeroed unless rwflg (as for bmap) is 2.
+ */
+static blkno_t
+data_alloc(inoptr ip, blkno_t lbn, int rwflg)
+{
+	blkno_t want;
+	char *buf;
+
+	if (ip->c_elen && lbn == ip->c_elblk + ip->c_elen) {
+		want = ip->c_epblk + ip->c_elen;
+		if (!ip->c_palen || ip->c_pablk != want) {
+			prerelease(ip);
+			prealloc(ip, want);
+		}
+		if (ip->c_palen) {
+			++ip->c_pablk;
+			--ip->c_palen;
+
+			/* Zero out the new block, as blk_alloc() does. */
+			if (rwflg != 2) {
+				buf = bread(ip->c_dev, want, 2);
+				bawrite(buf);
+			}
+			return (want);
+		}
+	}
+	return (blk_alloc(ip->c_dev));
+}
+
+/*
+ * data_next says how many blocks data_alloc() would hand out, one
+ * after another, to continue the inode's cached extent at lbn, which
+ * is not yet allocated.  It reserves them first, as data_alloc() does.
+ */
+int
+data_next(inoptr ip, blkno_t lbn)
+{
+	blkno_t want;
+
+	ifnot (ip->c_elen && lbn == ip->c_elblk + ip->c_elen)
+		return (0);
+	want = ip->c_epblk + ip->c_elen;
+	if (!ip->c_palen || ip->c_pablk != want) {
+		prerelease(ip);
+		prealloc(ip, want);
+	}
+	return (ip->c_palen);
+}
+
+/*
+ * prealloc reserves for the inode up to NPREALLOC blocks starting
+ * at want, as far as they run consecutively through the in-core
+ * free list.  s_free[0] is the link to the next free-list block,
+ * so it is never taken.  Reserved blocks are off the free list, and
+ * would be lost by a crash before they are used or given back.
+ */
+static void
+prealloc(inoptr ip, blkno_t want)
+{
+	fsptr dev;
+	int n;
+	int j;
+
+	ip->c_palen = 0;
+	if (baddev(dev = getdev(ip->c_dev)))
+		return;
+	for (n = 0; n < NPREALLOC && dev->s_tfree; ++n) {
+		for (j = 1; j < dev->s_nfree; ++j)
+			if (dev->s_free[j] == want + n)
+				break;
+		if (j >= dev->s_nfree)
+			break;
+		validblk(ip->c_dev, want + n);
+		dev->s_free[j] = dev->s_free[--dev->s_nfree];
+		--dev->s_tfree;
+	}
+	ip->c_pablk = want;
+	ip->c_palen = n;
+}
+
+/*
+ * prerelease returns the inode's unused reserved blocks to the
+ * free list.
+ */
+static void
+prerelease(inoptr ip)
+{
+	while (ip->c_palen) {
+		--ip->c_palen;
+		blk_free(ip->c_dev, ip->c_pablk++);
+	}
+}
+
+/*
+ * setext records in the inode's extent cache that logical block lbn
+ * is physical block pbn, and that the next n - 1 blocks follow it
+ * contiguously.  A run that continues the cached one extends it.
+ */
+void
+setext(inoptr ip, blkno_t lbn, blkno_t pbn, int n)
+{
+	if (ip->c_elen && ip->c_elen < 0x7fff &&
+	    lbn == ip->c_elblk + ip->c_elen &&
+	    pbn == ip->c_epblk + ip->c_elen) {
+		ip->c_elen += n;
+		return;
+	}
+	ip->c_elblk = lbn;
+	ip->c_epblk = pbn;
+	ip->c_elen = n;
+}
+
 /*
  * validblk panics if the given block number is not a valid
  * data block for the given device.
@@ -886,7 +1244,7 @@ validblk(int dev, blkno_t num)
 {
 	fsptr devptr;
 
-	devptr = fs_tab + dev;
+	devptr = fsof(dev);
 
 	if (devptr->s_mounted == 0)
 		panic("validblk: not mounted");
@@ -955,10 +1313,16 @@ getperm(inoptr ino)
 
 /*
  * setftime sets the times of the given inode, according to the flags.
+ * Nothing is set on a read-only filesystem, nor the access time on
+ * one mounted noatime, so that reading leaves the inode clean.
  */
 void
 setftime(inoptr ino, int flag)
 {
+	if (fsof(ino->c_dev)->s_flags & MNT_NOATIME)
+		flag &= ~A_TIME;
+	if (!flag || (fsof(ino->c_dev)->s_flags & MNT_RDONLY))
+		return;
 	ino->c_dirty = 1;
 
 	if (flag & A_TIME)
@@ -969,6 +1333,20 @@ setftime(inoptr ino, int flag)
 		rdtime(&(ino->c_node.i_mtime));
 }
 
+/*
+ * rdonly returns true, with the error EROFS, if the given inode is on
+ * a filesystem mounted read-only.
+ */
+int
+rdonly(inoptr ino)
+{
+	if (fsof(ino->c_dev)->s_flags & MNT_RDONLY) {
+		udata.u_error = EROFS;
+		return (1);
+	}
+	return (0);
+}
+
 /*
  * getmode returns the given inode's mode.
  */
@@ -987,18 +1365,75 @@ fmount(int dev, inoptr ino)
 {
 	char *buf;
 	struct filesys *fp;
+	struct d7super *d7;
+	struct d32super *d32;
+	int j;
 
 	if (d_open(dev) != 0)
 		panic("fmount: Cant open filesystem");
 	/* Dev 0 blk 1 */
-	fp = fs_tab + dev;
+	fp = fsof(dev);
+	bufinval(dev);		/* Drop blocks of any earlier size. */
 	buf = bread(dev, 1, 0);
-	bcopy(buf, (char *)fp, sizeof(struct filesys));
-	brelse(buf);
+	d7 = (struct d7super *)buf;
+	d32 = (struct d32super *)buf;
 
 	/* See if there really is a filesystem on the device. */
-	if (fp->s_mounted != SMOUNTED || fp->s_isize >= fp->s_fsize)
+	if (d7->s_mounted == SMOUNTED) {
+		fp->s_fstype = FS_V7;
+		fp->s_bshift = 9;
+		fp->s_inoshift = 3;
+		fp->s_indshift = 8;
+		fp->s_nlevels = 2;
+		fp->s_isize = d7->s_isize;
+		fp->s_fsize = d7->s_fsize;
+		fp->s_nfree = d7->s_nfree;
+		for (j = 0; j < 50; ++j)
+			fp->s_free[j] = d7->s_free[j];
+		fp->s_ninode = d7->s_ninode;
+		bcopy((char *)d7->s_inode, (char *)fp->s_inode,
+		    sizeof(fp->s_inode));
+		fp->s_fmod = d7->s_fmod;
+		fp->s_time = d7->s_time;
+		fp->s_tfree = d7->s_tfree;
+		fp->s_tinode = d7->s_tinode;
+	} else if (d32->s_mounted == SMOUNT32) {
+		fp->s_fstype = FS_32;
+		fp->s_bshift = d32->s_bshift ? d32->s_bshift : 9;
+		fp->s_inoshift = fp->s_bshift - 7;
+		fp->s_indshift = fp->s_bshift - 2;
+		fp->s_nlevels = 3;
+		fp->s_isize = d32->s_isize;
+		fp->s_fsize = d32->s_fsize;
+		fp->s_nfree = d32->s_nfree;
+		for (j = 0; j < 50; ++j)
+			fp->s_free[j] = d32->s_free[j];
+		fp->s_ninode = d32->s_ninode;
+		bcopy((char *)d32->s_inode, (char *)fp->s_inode,
+		    sizeof(fp->s_inode));
+		fp->s_fmod = d32->s_fmod;
+		fp->s_time = d32->s_time;
+		fp->s_tfree = d32->s_tfree;
+		fp->s_tinode = d32->s_tinode;
+	} else {
+		brelse(buf);
 		return (-1);
+	}
+	brelse(buf);
+
+	if (fp->s_isize >= fp->s_fsize || fp->s_bshift < 9 ||
+	    (1 << fp->s_bshift) > MAXBSIZE)
+		return (-1);
+
+	/*
+	 * The superblock is the second 512 bytes of the device, and the
+	 * inodes start in the first block after it.  From here on the
+	 * device is read in blocks of the filesystem's size.
+	 */
+	fp->s_ifirst = fp->s_bshift == 9 ? 2 : 1;
+	fp->s_flags = 0;
+	bufinval(dev);
+	fp->s_mounted = SMOUNTED;
 
 	fp->s_mntpt = ino;
 	if (ino)
@@ -1006,6 +1441,164 @@ fmount(int dev, inoptr ino)
 	return (0);
 }
 
+/*
+ * wr_super writes the superblock of the given device back to disk,
+ * in the format it was mounted with.
+ */
+void
+wr_super(int dev)
+{
+	char *buf;
+	fsptr fp;
+	struct d7super *d7;
+	struct d32super *d32;
+	int j;
+
+	fp = fsof(dev);
+	/* With larger blocks, the superblock shares block 0. */
+	if (fp->s_bshift == 9)
+		buf = bread(dev, 1, 2);
+	else
+		buf = bread(dev, 0, 0);
+	d7 = (struct d7super *)(buf + (512 & ((1 << fp->s_bshift) - 1)));
+	d32 = (struct d32super *)d7;
+	if (fp->s_fstype == FS_V7) {
+		d7->s_mounted = SMOUNTED;
+		d7->s_isize = fp->s_isize;
+		d7->s_fsize = fp->s_fsize;
+		d7->s_nfree = fp->s_nfree;
+		for (j = 0; j < 50; ++j)
+			d7->s_free[j] = fp->s_free[j];
+		d7->s_ninode = fp->s_ninode;
+		bcopy((char *)fp->s_inode, (char *)d7->s_inode,
+		    sizeof(fp->s_inode));
+		d7->s_fmod = fp->s_fmod;
+		d7->s_time = fp->s_time;
+		d7->s_tfree = fp->s_tfree;
+		d7->s_tinode = fp->s_tinode;
+	} else {
+		d32->s_mounted = SMOUNT32;
+		d32->s_isize = fp->s_isize;
+		d32->s_fsize = fp->s_fsize;
+		d32->s_nfree = fp->s_nfree;
+		for (j = 0; j < 50; ++j)
+			d32->s_free[j] = fp->s_free[j];
+		d32->s_ninode = fp->s_ninode;
+		bcopy((char *)fp->s_inode, (char *)d32->s_inode,
+		    sizeof(fp->s_inode));
+		d32->s_fmod = fp->s_fmod;
+		d32->s_time = fp->s_time;
+		d32->s_tfree = fp->s_tfree;
+		d32->s_tinode = fp->s_tinode;
+		d32->s_bshift = fp->s_bshift;
+	}
+	bfree(buf, 2);
+}
+
+/*
+ * rd_dinode copies inode slot n of an inode block into
+ * the in-core form of the inode.
+ */
+void
+rd_dinode(fsptr fp, char *buf, int n, dinode *dp)
+{
+	struct d7inode *d7;
+	struct d32inode *d32;
+	int j;
+
+	if (fp->s_fstype == FS_V7) {
+		d7 = (struct d7inode *)buf + n;
+		dp->i_mode = d7->i_mode;
+		dp->i_nlink = d7->i_nlink;
+		dp->i_uid = d7->i_uid;
+		dp->i_gid = d7->i_gid;
+		dp->i_size.o_blkno = d7->i_sizeblk;
+		dp->i_size.o_offset = d7->i_sizeoff;
+		dp->i_atime = d7->i_atime;
+		dp->i_mtime = d7->i_mtime;
+		dp->i_ctime = d7->i_ctime;
+		for (j = 0; j < 20; ++j)
+			dp->i_addr[j] = d7->i_addr[j];
+	} else {
+		d32 = (struct d32inode *)buf + n;
+		dp->i_mode = d32->i_mode;
+		dp->i_nlink = d32->i_nlink;
+		dp->i_uid = d32->i_uid;
+		dp->i_gid = d32->i_gid;
+		dp->i_size.o_blkno = d32->i_sizeblk;
+		dp->i_size.o_offset = d32->i_sizeoff;
+		dp->i_atime = d32->i_atime;
+		dp->i_mtime = d32->i_mtime;
+		dp->i_ctime = d32->i_ctime;
+		for (j = 0; j < 20; ++j)
+			dp->i_addr[j] = d32->i_addr[j];
+	}
+}
+
+/*
+ * wr_dinode is the reverse of rd_dinode.
+ */
+void
+wr_dinode(fsptr fp, char *buf, int n, dinode *dp)
+{
+	struct d7inode *d7;
+	struct d32inode *d32;
+	int j;
+
+	if (fp->s_fstype == FS_V7) {
+		d7 = (struct d7inode *)buf + n;
+		d7->i_mode = dp->i_mode;
+		d7->i_nlink = dp->i_nlink;
+		d7->i_uid = dp->i_uid;
+		d7->i_gid = dp->i_gid;
+		d7->i_sizeblk = dp->i_size.o_blkno;
+		d7->i_sizeoff = dp->i_size.o_offset;
+		d7->i_atime = dp->i_atime;
+		d7->i_mtime = dp->i_mtime;
+		d7->i_ctime = dp->i_ctime;
+		for (j = 0; j < 20; ++j)
+			d7->i_addr[j] = dp->i_addr[j];
+	} else {
+		d32 = (struct d32inode *)buf + n;
+		d32->i_mode = dp->i_mode;
+		d32->i_nlink = dp->i_nlink;
+		d32->i_uid = dp->i_uid;
+		d32->i_gid = dp->i_gid;
+		d32->i_sizeblk = dp->i_size.o_blkno;
+		d32->i_sizeoff = dp->i_size.o_offset;
+		d32->i_pad = 0;
+		d32->i_atime = dp->i_atime;
+		d32->i_mtime = dp->i_mtime;
+		d32->i_ctime = dp->i_ctime;
+		for (j = 0; j < 20; ++j)
+			d32->i_addr[j] = dp->i_addr[j];
+	}
+}
+
+/*
+ * getind returns entry n of an indirect or free-list block.
+ * Entries are 16 bits wide on a V7 filesystem, and 32 bits otherwise.
+ */
+blkno_t
+getind(fsptr fp, char *buf, int n)
+{
+	if (fp->s_fstype == FS_V7)
+		return (((uint16 *)buf)[n]);
+	return (((uint32 *)buf)[n]);
+}
+
+/*
+ * setind stores entry n of an indirect or free-list block.
+ */
+void
+setind(fsptr fp, char *buf, int n, blkno_t blk)
+{
+	if (fp->s_fstype == FS_V7)
+		((uint16 *)buf)[n] = blk;
+	else
+		((uint32 *)buf)[n] = blk;
+}
+
 /*
  * magic checks if the given inode is corrupt.
  */
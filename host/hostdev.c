@@ -0,0 +1,526 @@
+/**************************************************
+UZI (Unix Z80 Implementation) Kernel:  host/hostdev.c
+***************************************************/
+
+/*
+ * The hardware underneath the hosted kernel: I/O ports, the SCSI
+ * disk (an image file), the user's memory, and the few Q/C library
+ * routines the kernel uses.  This file sees only the host's headers,
+ * never unix.h.
+ */
+
+#define _GNU_SOURCE		/* For REG_RIP. */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define TICKNSEC	100000000L	/* TICKSPERSEC is 10. */
+#define RDCMD		0x28
+#define WRCMD		0x2a
+#define PROFUSEC	1000		/* CPU time between profile samples. */
+#define RAMSIZE		0x100000	/* Banked memory for the RAM disk. */
+
+extern char *	cptr;		/* The SCSI command, from devwd.c. */
+extern char *	dptr;
+extern int	dlen;
+
+char *		hostmem;	/* The user's 32K. */
+static char	ram[RAMSIZE];	/* The banks beyond it. */
+
+long		hd_nread;	/* SCSI read commands. */
+long		hd_nwrite;	/* SCSI write commands. */
+long		hd_rblk;	/* 512-byte blocks read. */
+long		hd_wblk;	/* 512-byte blocks written. */
+long		hd_seek;	/* Blocks the head has moved over. */
+long		hd_nasync;	/* Commands started by scsistart(). */
+long		hd_nspin;	/* Times the kernel waited for one. */
+long		hd_latency = 100; /* Kernel calls a started command takes. */
+
+static long	hd_pos;		/* Where the last command left the head. */
+
+static unsigned char hd_cmd[10]; /* The started command. */
+static char *	hd_ptr;
+static int	hd_len;
+static int	hd_busy;
+static long	hd_due;		/* When, in hk_calls, it will be done. */
+
+long		hk_calls;	/* Kernel function calls. */
+long		hk_bytes;	/* Bytes moved by bcopy() and bzero(). */
+
+static int	diskfd = -1;
+static FILE *	script;
+
+static int	clkon;
+static struct timespec nexttick;
+static int	nforced;	/* Ticks due now, from hosttick(). */
+
+static int	rxchar = -1;	/* Character waiting in the UART. */
+static int	rxeof;
+
+int		hostinit(void);
+int		hostdisk(char *);
+int		hostscript(char *);
+int		hostram(char *);
+int		hostgets(char *, int);
+long		hostusec(void);
+void		hostwait(void);
+int		in(int);
+void		out(int, int);
+int		scsiop(void);
+int		scsistart(void);
+int		scsiint(void);
+int		scsiwait(void);
+int		scsiend(void);
+void		hostthink(long);
+int		hosttick(int);
+void		rdcopy(unsigned int, char *, unsigned int, int);
+char *		itob(int, char *, int);
+
+#define NOPROF		__attribute__((no_instrument_function))
+
+void		__cyg_profile_func_enter(void *, void *) NOPROF;
+void		__cyg_profile_func_exit(void *, void *) NOPROF;
+
+static int	rxready(void);
+static int	tickdue(int);
+static int	bcd(int);
+static int	hdop(unsigned char *, char *, int);
+#ifdef PROFIL
+extern void	prof_tick(char *);
+
+static void	profsig(int, siginfo_t *, void *);
+#endif
+
+/*
+ * hostinit maps the user's memory.  Pointers are passed to the
+ * kernel in ints, so it must lie in the low 2G.  With PROFIL, it
+ * also starts the profiling timer, which stands in for the clock
+ * interrupt: the hosted kernel only takes clock ticks when idle.
+ */
+int
+hostinit(void)
+{
+#ifdef PROFIL
+	struct sigaction sa;
+	struct itimerval it;
+#endif
+
+	hostmem = mmap(NULL, 0x8000, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (hostmem == MAP_FAILED)
+		return (-1);
+#ifdef PROFIL
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = profsig;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigaction(SIGPROF, &sa, NULL);
+	it.it_interval.tv_sec = it.it_value.tv_sec = 0;
+	it.it_interval.tv_usec = it.it_value.tv_usec = PROFUSEC;
+	setitimer(ITIMER_PROF, &it, NULL);
+#endif
+	return (0);
+}
+
+int
+hostdisk(char *path)
+{
+	return (diskfd = open(path, O_RDWR));
+}
+
+int
+hostscript(char *path)
+{
+	script = fopen(path, "r");
+	return (script ? 0 : -1);
+}
+
+/*
+ * hostram loads a filesystem image into the RAM disk, as a boot
+ * loader might.
+ */
+int
+hostram(char *path)
+{
+	int fd;
+	int n;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	n = read(fd, ram, RAMSIZE);
+	close(fd);
+	return (n < 0 ? -1 : 0);
+}
+
+/*
+ * hostgets reads the next line of the script, without its newline.
+ */
+int
+hostgets(char *buf, int n)
+{
+	char *p;
+
+	if (!fgets(buf, n, script))
+		return (0);
+	if ((p = strchr(buf, '\n')) != NULL)
+		*p = '\0';
+	return (1);
+}
+
+/*
+ * hostusec returns the CPU time used so far, in microseconds.
+ */
+long
+hostusec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (ts.tv_sec * 1000000L + ts.tv_nsec / 1000);
+}
+
+/*
+ * hostwait blocks until the UART has a character or the clock is
+ * due to tick.  It is what the kernel's idle loop spins on.
+ */
+void
+hostwait(void)
+{
+	struct pollfd pfd;
+	struct timespec now;
+	long ms;
+
+	while (!rxready() && !tickdue(0)) {
+		pfd.fd = rxeof ? -1 : 0;
+		pfd.events = POLLIN;
+		ms = -1;
+		if (clkon) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			ms = (nexttick.tv_sec - now.tv_sec) * 1000 +
+			    (nexttick.tv_nsec - now.tv_nsec) / 1000000 + 1;
+			if (ms < 0)
+				ms = 0;
+		} else if (rxeof) {
+			fprintf(stderr, "hostwait: no clock and no input\n");
+			exit(1);
+		}
+		poll(&pfd, 1, (int)ms);
+	}
+}
+
+int
+in(int port)
+{
+	struct tm *tm;
+	time_t t;
+	int c;
+
+	switch (port) {
+	case 0x72:		/* UART status. */
+		return (rxready() ? 0x83 : 0x02);
+	case 0x73:		/* UART data. */
+		c = rxchar;
+		rxchar = -1;
+		return (c & 0xff);
+	case 0xf0:		/* Clock interrupt pending. */
+		return (tickdue(1));
+	case 0xe2:
+	case 0xe3:
+	case 0xe4:
+	case 0xe6:
+	case 0xe7:
+		t = time(NULL);
+		tm = localtime(&t);
+		switch (port) {
+		case 0xe2:
+			return (bcd(tm->tm_sec));
+		case 0xe3:
+			return (bcd(tm->tm_min));
+		case 0xe4:
+			return (bcd(tm->tm_hour));
+		case 0xe6:
+			return (bcd(tm->tm_mday));
+		default:
+			return (bcd(tm->tm_mon + 1));
+		}
+	case 0x80:		/* There is no floppy drive. */
+		return (0x80);
+	default:		/* The printer is always ready. */
+		return (0);
+	}
+}
+
+void
+out(int val, int port)
+{
+	char c;
+
+	switch (port) {
+	case 0x73:
+		c = val;
+		write(1, &c, 1);
+		break;
+	case 0xf1:
+		clkon = val & 02;
+		clock_gettime(CLOCK_MONOTONIC, &nexttick);
+		break;
+	}
+}
+
+/*
+ * scsiop carries out the command devwd.c has set up, on the disk
+ * image.
+ */
+int
+scsiop(void)
+{
+	return (hdop((unsigned char *)cptr, dptr, dlen));
+}
+
+/*
+ * scsistart, scsiint and scsiend simulate a controller that works on
+ * its own and interrupts when it is done.  A started command takes
+ * hd_latency kernel function calls, and moves its data only at the
+ * end, so a buffer the kernel touches too early shows up.
+ */
+int
+scsistart(void)
+{
+	if (hd_busy)
+		return (-3);
+	memcpy(hd_cmd, cptr, sizeof(hd_cmd));
+	hd_ptr = dptr;
+	hd_len = dlen;
+	hd_busy = 1;
+	hd_due = hk_calls + hd_latency;
+	++hd_nasync;
+	return (0);
+}
+
+int
+scsiint(void)
+{
+	return (hd_busy && hk_calls >= hd_due);
+}
+
+/*
+ * scsiwait is called while the kernel can do nothing but wait for
+ * the started command, which is then done at once.  It returns
+ * whether there was one.
+ */
+int
+scsiwait(void)
+{
+	if (!hd_busy)
+		return (0);
+	if (hk_calls < hd_due) {
+		++hd_nspin;
+		hd_due = hk_calls;
+	}
+	return (1);
+}
+
+/*
+ * hostthink lets the disk work on by itself for n calls' worth of
+ * time, which the user program spends between system calls.
+ */
+void
+hostthink(long n)
+{
+	if (hd_busy)
+		hd_due -= n;
+}
+
+/*
+ * hosttick makes n more clock ticks due at once, for a script that
+ * wants time to pass, and returns how many are still due.
+ */
+int
+hosttick(int n)
+{
+	return (nforced += n);
+}
+
+int
+scsiend(void)
+{
+	hd_busy = 0;
+	return (hdop(hd_cmd, hd_ptr, hd_len));
+}
+
+/*
+ * rdcopy moves n bytes between p and byte addr of the RAM disk.
+ */
+void
+rdcopy(unsigned int addr, char *p, unsigned int n, int wr)
+{
+	if (addr + n > RAMSIZE) {
+		fprintf(stderr, "rdcopy: past the end of memory\n");
+		exit(1);
+	}
+	if (wr)
+		memcpy(ram + addr, p, n);
+	else
+		memcpy(p, ram + addr, n);
+}
+
+/*
+ * itob converts n to a string in the given base.  A negative base
+ * means n is signed.
+ */
+char *
+itob(int n, char *s, int base)
+{
+	char buf[12];
+	unsigned int u;
+	char *p;
+	char *q;
+
+	q = s;
+	u = n;
+	if (base < 0) {
+		base = -base;
+		if (n < 0) {
+			*q++ = '-';
+			u = -n;
+		}
+	}
+	p = buf;
+	do {
+		*p++ = "0123456789abcdef"[u % base];
+		u /= base;
+	} while (u);
+	while (p > buf)
+		*q++ = *--p;
+	*q = '\0';
+	return (s);
+}
+
+/*
+ * The kernel is compiled with -finstrument-functions, which calls
+ * these on the way in and out of each of its functions.  Counting
+ * the calls gives a measure of the kernel's work that, unlike the
+ * host's clock, is the same from one run to the next.
+ */
+void
+__cyg_profile_func_enter(void *fn, void *site)
+{
+	++hk_calls;
+}
+
+void
+__cyg_profile_func_exit(void *fn, void *site)
+{
+}
+
+/*
+ * rxready looks ahead one character on stdin.  End of file is seen
+ * once, as a ^D.
+ */
+static int
+rxready(void)
+{
+	struct pollfd pfd;
+	unsigned char c;
+
+	if (rxchar >= 0)
+		return (1);
+	if (rxeof)
+		return (0);
+	pfd.fd = 0;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) <= 0)
+		return (0);
+	if (read(0, &c, 1) == 1)
+		rxchar = c;
+	else {
+		rxeof = 1;
+		rxchar = '\004';
+	}
+	return (1);
+}
+
+/*
+ * tickdue says whether the clock is due to tick, and if take is set,
+ * counts the tick as taken.
+ */
+static int
+tickdue(int take)
+{
+	struct timespec now;
+
+	if (!clkon)
+		return (0);
+	if (nforced) {
+		if (take)
+			--nforced;
+		return (1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec < nexttick.tv_sec || (now.tv_sec == nexttick.tv_sec &&
+	    now.tv_nsec < nexttick.tv_nsec))
+		return (0);
+	if (!take)
+		return (1);
+	if ((nexttick.tv_nsec += TICKNSEC) >= 1000000000L) {
+		nexttick.tv_nsec -= 1000000000L;
+		++nexttick.tv_sec;
+	}
+	return (1);
+}
+
+#ifdef PROFIL
+/*
+ * profsig passes the interrupted PC to the kernel's profiler.
+ */
+static void
+profsig(int sig, siginfo_t *si, void *uc)
+{
+	prof_tick((char *)((ucontext_t *)uc)->uc_mcontext.gregs[REG_RIP]);
+}
+#endif
+
+/*
+ * hdop carries out a command on the disk image.  Reads past the end
+ * of the image return zeros.
+ */
+static int
+hdop(unsigned char *c, char *p, int len)
+{
+	off_t off;
+	ssize_t n;
+
+	off = ((off_t)c[2] << 24 | c[3] << 16 | c[4] << 8 | c[5]) * 512;
+	hd_seek += labs(off / 512 - hd_pos);
+	hd_pos = (off + len) / 512;
+	switch (c[0]) {
+	case RDCMD:
+		if ((n = pread(diskfd, p, len, off)) < 0)
+			return (-1);
+		memset(p + n, 0, len - n);
+		++hd_nread;
+		hd_rblk += len >> 9;
+		return (0);
+	case WRCMD:
+		if (pwrite(diskfd, p, len, off) != len)
+			return (-1);
+		++hd_nwrite;
+		hd_wblk += len >> 9;
+		return (0);
+	}
+	return (-2);
+}
+
+static int
+bcd(int n)
+{
+	return ((n / 10) << 4 | n % 10);
+}
@@ -0,0 +1,162 @@
+/**************************************************
+UZI (Unix Z80 Implementation) Kernel:  host/kprof.c
+***************************************************/
+
+/*
+ * kprof totals a kernel profile by routine.
+ *
+ *	kprof symfile [proffile]
+ *
+ * symfile is a symbol table, one symbol to a line as an address in
+ * hex and a name, with or without a type letter between them: the
+ * output of nm, or of the linker's symbol listing for the Z80
+ * kernel.  Only text symbols are used when there are types.  "-"
+ * reads it from the standard input.
+ *
+ * proffile (by default the standard input) has the profile as
+ * uzihost prints it, lines of "pc address ticks", and anything else,
+ * which is ignored.  Each bucket is charged to the routine its first
+ * address falls in, so the buckets should be small next to the
+ * routines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXSYMS		8192
+
+struct sym {
+	unsigned long	s_addr;
+	char *		s_name;
+	unsigned long	s_ticks;
+};
+
+static struct sym	syms[MAXSYMS];
+static int		nsyms;
+
+static void	rdsyms(FILE *);
+static void	rdprof(FILE *);
+static struct sym *	lookup(unsigned long);
+static int	byaddr(const void *, const void *);
+static int	byticks(const void *, const void *);
+static FILE *	fopenarg(char *);
+
+int
+main(int argc, char **argv)
+{
+	unsigned long total;
+	int j;
+
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "usage: kprof symfile [proffile]\n");
+		exit(2);
+	}
+	rdsyms(fopenarg(argv[1]));
+	qsort(syms, nsyms, sizeof(syms[0]), byaddr);
+	rdprof(argc == 3 ? fopenarg(argv[2]) : stdin);
+
+	qsort(syms, nsyms, sizeof(syms[0]), byticks);
+	total = 0;
+	for (j = 0; j < nsyms; ++j)
+		total += syms[j].s_ticks;
+	if (total == 0) {
+		printf("no kernel ticks\n");
+		exit(0);
+	}
+	printf("%8s %6s  %s\n", "ticks", "%", "routine");
+	for (j = 0; j < nsyms && syms[j].s_ticks; ++j)
+		printf("%8lu %6.2f  %s\n", syms[j].s_ticks,
+		    100.0 * syms[j].s_ticks / total, syms[j].s_name);
+	exit(0);
+}
+
+static void
+rdsyms(FILE *f)
+{
+	char line[512];
+	char name[256];
+	char type[8];
+	unsigned long addr;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx %7s %255s", &addr, type, name) == 3) {
+			if (type[1] != '\0' || strchr("Tt", type[0]) == NULL)
+				continue;
+		} else if (sscanf(line, "%lx %255s", &addr, name) != 2)
+			continue;
+		if (nsyms == MAXSYMS) {
+			fprintf(stderr, "kprof: too many symbols\n");
+			exit(1);
+		}
+		syms[nsyms].s_addr = addr;
+		syms[nsyms].s_name = strdup(name);
+		++nsyms;
+	}
+}
+
+static void
+rdprof(FILE *f)
+{
+	char line[512];
+	unsigned long addr;
+	unsigned long ticks;
+	struct sym *sp;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "pc %lx %lu", &addr, &ticks) != 2)
+			continue;
+		if ((sp = lookup(addr)) != NULL)
+			sp->s_ticks += ticks;
+	}
+}
+
+/*
+ * lookup finds the last symbol at or below addr.
+ */
+static struct sym *
+lookup(unsigned long addr)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = nsyms;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (syms[mid].s_addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo > 0 ? &syms[lo - 1] : NULL);
+}
+
+static int
+byaddr(const void *a, const void *b)
+{
+	const struct sym *s = a, *t = b;
+
+	return (s->s_addr < t->s_addr ? -1 : s->s_addr > t->s_addr);
+}
+
+static int
+byticks(const void *a, const void *b)
+{
+	const struct sym *s = a, *t = b;
+
+	return (s->s_ticks > t->s_ticks ? -1 : s->s_ticks < t->s_ticks);
+}
+
+static FILE *
+fopenarg(char *path)
+{
+	FILE *f;
+
+	if (strcmp(path, "-") == 0)
+		return (stdin);
+	if ((f = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "kprof: can't open %s\n", path);
+		exit(1);
+	}
+	return (f);
+}
@@ -0,0 +1,135 @@
+/**************************************************
+UZI (Unix Z80 Implementation) Kernel:  host/ktsum.c
+***************************************************/
+
+/*
+ * ktsum summarizes a system call trace by call.
+ *
+ *	ktsum [-p pid] [tracefile]
+ *
+ * The trace (by default the standard input) is the records read
+ * from /dev/ktrace, printed as uzihost does, one to a line:
+ *
+ *	kt seq call pid retval error start end
+ *
+ * Other lines are ignored, as are calls named "-", which is what
+ * uzihost calls its own reads of the trace.  For each call it prints
+ * how many were made, how many failed, and the total, mean and
+ * longest time in the kernel, in milliseconds; start and end are in
+ * clock ticks.  -p counts only the calls of one process.  Gaps in
+ * seq are counted as lost records.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TICKSPERSEC	10
+#define MAXCALLS	64
+
+struct call {
+	char		c_name[16];
+	unsigned long	c_n;
+	unsigned long	c_err;
+	unsigned long	c_ticks;
+	unsigned long	c_max;
+};
+
+static struct call	calls[MAXCALLS];
+static int		ncalls;
+
+static struct call *	lookup(char *);
+static int		byticks(const void *, const void *);
+
+int
+main(int argc, char **argv)
+{
+	char line[256];
+	char name[16];
+	unsigned int seq, lastseq;
+	unsigned long start, end, lost, total;
+	int pid, want, retval, error;
+	struct call *cp;
+	FILE *f;
+	int j;
+
+	want = -1;
+	if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+		want = atoi(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc > 2) {
+		fprintf(stderr, "usage: ktsum [-p pid] [tracefile]\n");
+		exit(2);
+	}
+	f = stdin;
+	if (argc == 2 && (f = fopen(argv[1], "r")) == NULL) {
+		fprintf(stderr, "ktsum: can't open %s\n", argv[1]);
+		exit(1);
+	}
+
+	lost = total = 0;
+	lastseq = 0;
+	j = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "kt %u %15s %d %d %d %lu %lu", &seq, name, &pid,
+		    &retval, &error, &start, &end) != 7)
+			continue;
+		if (j++ && ((seq - lastseq - 1) & 0xffff) < 0x8000)
+			lost += (seq - lastseq - 1) & 0xffff;
+		lastseq = seq;
+		if ((want >= 0 && pid != want) || strcmp(name, "-") == 0)
+			continue;
+		cp = lookup(name);
+		++cp->c_n;
+		if (error)
+			++cp->c_err;
+		cp->c_ticks += end - start;
+		if (end - start > cp->c_max)
+			cp->c_max = end - start;
+		total += end - start;
+	}
+
+	qsort(calls, ncalls, sizeof(calls[0]), byticks);
+	printf("%-10s %8s %6s %10s %8s %8s\n", "call", "count", "errs",
+	    "total ms", "mean ms", "max ms");
+	for (j = 0; j < ncalls; ++j) {
+		cp = &calls[j];
+		printf("%-10s %8lu %6lu %10lu %8.1f %8lu\n", cp->c_name, cp->c_n,
+		    cp->c_err, cp->c_ticks * 1000 / TICKSPERSEC,
+		    (double)cp->c_ticks * 1000 / TICKSPERSEC / cp->c_n,
+		    cp->c_max * 1000 / TICKSPERSEC);
+	}
+	printf("%lu ms in the kernel", total * 1000 / TICKSPERSEC);
+	if (lost)
+		printf(", %lu records lost", lost);
+	printf("\n");
+	exit(0);
+}
+
+static struct call *
+lookup(char *name)
+{
+	int j;
+
+	for (j = 0; j < ncalls; ++j)
+		if (strcmp(calls[j].c_name, name) == 0)
+			return (&calls[j]);
+	if (ncalls == MAXCALLS) {
+		fprintf(stderr, "ktsum: too many calls\n");
+		exit(1);
+	}
+	strcpy(calls[ncalls].c_name, name);
+	return (&calls[ncalls++]);
+}
+
+static int
+byticks(const void *a, const void *b)
+{
+	const struct call *s = a, *t = b;
+
+	if (s->c_ticks != t->c_ticks)
+		return (s->c_ticks > t->c_ticks ? -1 : 1);
+	return (s->c_n > t->c_n ? -1 : s->c_n < t->c_n);
+}
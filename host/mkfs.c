@@ -0,0 +1,311 @@
+/**************************************************
+UZI (Unix Z80 Implementation) Kernel:  host/mkfs.c
+***************************************************/
+
+/*
+ * mkfs makes an empty filesystem in a disk image, for the hosted
+ * kernel.
+ *
+ *	mkfs [-3] [-b bsize] [-f il,skew] image base isize fsize
+ *
+ * base is where the partition starts in the image, in 512-byte
+ * blocks.  isize (the first data block) and fsize are in filesystem
+ * blocks.  -3 makes a 32-bit filesystem; -b, which implies it, sets
+ * its block size.  The free list is laid out so that blocks are
+ * handed out in ascending order.
+ *
+ * -f makes the image a floppy's, 26 128-byte sectors to the track,
+ * in physical sector order, to be copied to a diskette track by
+ * track: the sectors are placed as devfd.c maps them with the given
+ * interleave and skew, which must then be set for the drive (FDIL
+ * and FDSKEW, or the FDSETIL ioctl).
+ */
+
+#include "unix.h"
+
+extern int	printf(const char *, ...);
+extern void	exit(int);
+extern int	open(const char *, int, ...);
+extern long	pread(int, void *, unsigned long, long);
+extern long	pwrite(int, const void *, unsigned long, long);
+extern int	close(int);
+
+#define O_CREAT		0100
+#define FDSECS		26
+
+int		main(int, char **);
+
+static void	wblk(blkno_t, char *);
+static long	imgio(int, char *, long, long);
+static void	fdmap(int, int);
+static void	wino(unsigned int, dinode *);
+static void	bfree(blkno_t);
+static long	num(char *);
+static void	usage(void);
+
+static int	fd;
+static long	base;
+static int	fs32;
+static int	bshift = 9;
+static int	ifirst;
+static int	inoshift;
+static filesys	fs;
+static char	buf[MAXBSIZE];
+static int	floppy;
+static int	fdskew;
+static char	fdsec[FDSECS];	/* Physical place of each logical sector. */
+
+int
+main(int argc, char **argv)
+{
+	d7super *d7;
+	d32super *d32;
+	dinode ino;
+	direct *dp;
+	blkno_t b;
+	unsigned int ninodes;
+	int j;
+
+	for (++argv, --argc; argc > 0 && **argv == '-'; ++argv, --argc) {
+		if ((*argv)[1] == '3')
+			fs32 = 1;
+		else if ((*argv)[1] == 'b' && argc > 1) {
+			fs32 = 1;
+			for (j = num(*++argv), --argc, bshift = 0; j > 1; j >>= 1)
+				++bshift;
+		} else if ((*argv)[1] == 'f' && argc > 1) {
+			floppy = 1;
+			j = num(*++argv);
+			--argc;
+			while (**argv >= '0' && **argv <= '9')
+				++*argv;
+			if (**argv != ',' || j < 1 || j >= FDSECS ||
+			    num(*argv + 1) >= FDSECS)
+				usage();
+			fdmap(j, num(*argv + 1));
+		} else
+			usage();
+	}
+	if (argc != 4)
+		usage();
+	base = num(argv[1]);
+	fs.s_isize = num(argv[2]);
+	fs.s_fsize = num(argv[3]);
+
+	if (bshift < 9 || (1 << bshift) > MAXBSIZE) {
+		printf("mkfs: block size must be 512 to %d\n", MAXBSIZE);
+		exit(1);
+	}
+	ifirst = bshift == 9 ? 2 : 1;
+	inoshift = bshift - (fs32 ? 7 : 6);
+	if (fs.s_isize <= ifirst || fs.s_isize >= fs.s_fsize ||
+	    (!fs32 && fs.s_fsize > 0xffff)) {
+		printf("mkfs: bad sizes\n");
+		exit(1);
+	}
+	if ((fd = open(argv[0], O_RDWR | O_CREAT, 0666)) < 0) {
+		printf("mkfs: can't open %s\n", argv[0]);
+		exit(1);
+	}
+
+	/* Clear the boot block, superblock and inodes. */
+	for (b = 0; b < fs.s_isize; ++b)
+		wblk(b, buf);
+
+	/* Inode 0 is never used. */
+	bzero(&ino, sizeof(ino));
+	ino.i_nlink = 1;
+	wino(0, &ino);
+
+	/* The root directory is inode 1, in the first data block. */
+	ino.i_mode = F_DIR | 0755;
+	ino.i_nlink = 2;
+	ino.i_size.o_offset = 2 * sizeof(direct);
+	ino.i_addr[0] = fs.s_isize;
+	wino(ROOTINODE, &ino);
+	dp = (direct *)buf;
+	dp[0].d_ino = dp[1].d_ino = ROOTINODE;
+	dp[0].d_name[0] = dp[1].d_name[0] = dp[1].d_name[1] = '.';
+	wblk(fs.s_isize, buf);
+	bzero(buf, sizeof(buf));
+
+	/* Free the rest, highest first, as blk_free() would. */
+	fs.s_nfree = 1;
+	fs.s_free[0] = 0;
+	for (b = fs.s_fsize - 1; b > fs.s_isize; --b)
+		bfree(b);
+
+	ninodes = (fs.s_isize - ifirst) << inoshift;
+	fs.s_tinode = ninodes - 2;
+	if (fs32) {
+		d32 = (d32super *)buf;
+		d32->s_mounted = SMOUNT32;
+		d32->s_isize = fs.s_isize;
+		d32->s_fsize = fs.s_fsize;
+		d32->s_nfree = fs.s_nfree;
+		for (j = 0; j < 50; ++j)
+			d32->s_free[j] = fs.s_free[j];
+		d32->s_tfree = fs.s_tfree;
+		d32->s_tinode = fs.s_tinode;
+		d32->s_bshift = bshift;
+	} else {
+		d7 = (d7super *)buf;
+		d7->s_mounted = SMOUNTED;
+		d7->s_isize = fs.s_isize;
+		d7->s_fsize = fs.s_fsize;
+		d7->s_nfree = fs.s_nfree;
+		for (j = 0; j < 50; ++j)
+			d7->s_free[j] = fs.s_free[j];
+		d7->s_tfree = fs.s_tfree;
+		d7->s_tinode = fs.s_tinode;
+	}
+	/* The superblock is always the second 512 bytes. */
+	if (imgio(1, buf, 512, (base + 1) * 512) != 512) {
+		printf("mkfs: write error\n");
+		exit(1);
+	}
+	close(fd);
+
+	printf("%s: %s, %d-byte blocks, %u inodes, %u free blocks\n",
+	    argv[0], fs32 ? "32-bit" : "V7", 1 << bshift, ninodes,
+	    (unsigned)fs.s_tfree);
+	exit(0);
+}
+
+static void
+wblk(blkno_t b, char *p)
+{
+	if (imgio(1, p, 1 << bshift, base * 512 + ((long)b << bshift)) !=
+	    1 << bshift) {
+		printf("mkfs: write error\n");
+		exit(1);
+	}
+}
+
+/*
+ * imgio reads or writes n bytes at offset off in the filesystem's
+ * terms.  On a floppy each 128-byte sector goes to its physical
+ * place on its track.
+ */
+static long
+imgio(int wr, char *p, long n, long off)
+{
+	long done;
+	long ls;
+	long t;
+
+	ifnot (floppy)
+		return (wr ? pwrite(fd, p, n, off) : pread(fd, p, n, off));
+	for (done = 0; done < n; done += 128) {
+		ls = (off + done) / 128;
+		t = ls / FDSECS;
+		ls = (t * FDSECS + (fdsec[ls % FDSECS] + t * fdskew) % FDSECS) * 128;
+		if ((wr ? pwrite(fd, p + done, 128, ls) :
+		    pread(fd, p + done, 128, ls)) != 128 && wr)
+			return (-1);
+	}
+	return (n);
+}
+
+/*
+ * fdmap places the logical sectors il physical sectors apart, the
+ * same way as devfd.c.
+ */
+static void
+fdmap(int il, int skew)
+{
+	char used[FDSECS];
+	int p;
+	int j;
+
+	fdskew = skew;
+	bzero(used, FDSECS);
+	p = 0;
+	for (j = 0; j < FDSECS; ++j) {
+		while (used[p])
+			p = (p + 1) % FDSECS;
+		fdsec[j] = p;
+		used[p] = 1;
+		p = (p + il) % FDSECS;
+	}
+}
+
+/*
+ * wino writes an inode, reading in the block around it first.
+ */
+static void
+wino(unsigned int n, dinode *ip)
+{
+	static char ibuf[MAXBSIZE];
+	d7inode *d7;
+	d32inode *d32;
+	long off;
+	int j;
+
+	off = base * 512 + ((long)((n >> inoshift) + ifirst) << bshift);
+	imgio(0, ibuf, 1 << bshift, off);
+	n &= (1 << inoshift) - 1;
+	if (fs32) {
+		d32 = (d32inode *)ibuf + n;
+		bzero(d32, sizeof(*d32));
+		d32->i_mode = ip->i_mode;
+		d32->i_nlink = ip->i_nlink;
+		d32->i_sizeblk = ip->i_size.o_blkno;
+		d32->i_sizeoff = ip->i_size.o_offset;
+		for (j = 0; j < 20; ++j)
+			d32->i_addr[j] = ip->i_addr[j];
+	} else {
+		d7 = (d7inode *)ibuf + n;
+		bzero(d7, sizeof(*d7));
+		d7->i_mode = ip->i_mode;
+		d7->i_nlink = ip->i_nlink;
+		d7->i_sizeblk = ip->i_size.o_blkno;
+		d7->i_sizeoff = ip->i_size.o_offset;
+		for (j = 0; j < 20; ++j)
+			d7->i_addr[j] = ip->i_addr[j];
+	}
+	imgio(1, ibuf, 1 << bshift, off);
+}
+
+/*
+ * bfree puts a block on the free list, writing out the list into
+ * the block when it is full.
+ */
+static void
+bfree(blkno_t b)
+{
+	static char fbuf[MAXBSIZE];
+	int j;
+
+	if (fs.s_nfree == 50) {
+		bzero(fbuf, sizeof(fbuf));
+		*(int16 *)fbuf = fs.s_nfree;
+		for (j = 0; j < 50; ++j)
+			if (fs32)
+				((uint32 *)fbuf)[j + 1] = fs.s_free[j];
+			else
+				((uint16 *)fbuf)[j + 1] = fs.s_free[j];
+		wblk(b, fbuf);
+		fs.s_nfree = 0;
+	}
+	++fs.s_tfree;
+	fs.s_free[fs.s_nfree++] = b;
+}
+
+static long
+num(char *s)
+{
+	long n;
+
+	for (n = 0; *s >= '0' && *s <= '9'; ++s)
+		n = n * 10 + *s - '0';
+	return (n);
+}
+
+static void
+usage(void)
+{
+	printf("usage: mkfs [-3] [-b bsize] [-f il,skew] "
+	    "image base isize fsize\n");
+	exit(1);
+}
@@ -0,0 +1,172 @@
+/**************************************************
+UZI (Unix Z80 Implementation) Kernel:  host/swzbench.c
+***************************************************/
+
+/*
+ * swzbench weighs compressed swap images (SWAPZ) against plain ones.
+ *
+ *	swzbench [-m mhz] [-p cycles] [-u cycles] [-r kbps] file ...
+ *
+ * Each file is laid out as a user's image would be: its bytes from
+ * PROGBASE, zeros above them, and a last 1K of stack and udata taken
+ * from the start of the file.  The image is packed a block at a time
+ * and unpacked with the kernel's zpack() and zunpack(), as swdisk()
+ * and swapin() do, and checked.
+ *
+ * There is no Z80 to time here, so the processor's part is reckoned
+ * at -p cycles for each byte packed and -u for each byte unpacked, at
+ * -m MHz; the defaults are guesses for compiled C on a 4 MHz Z80.
+ * For each image it prints the blocks each way, the processor time
+ * of a swap out and in, and the crossover: the disk rate, in KB/s,
+ * below which the compressed image is the quicker.  With -r, the
+ * disk's rate, it also prints the time saved (or lost) per swap.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGBASE	0x100
+#define TOP		(0x8000 + 256)	/* The top of udata, near enough. */
+#define IMAGE		(TOP - PROGBASE)
+#define NBLK		(1 + (IMAGE >> 9))	/* As swdisk() writes it. */
+
+extern int	zpack(char **, char *, char *, int);
+extern char *	zunpack(char *, int, char *, char *);
+
+long		hk_bytes;	/* For extras.c. */
+
+static char	image[IMAGE];
+static long	used;		/* Bytes of the file in it. */
+static char	back[IMAGE];
+static char	disk[NBLK][512];
+
+static int	load(char *);
+static int	pack(void);
+static void	unpack(int);
+
+int
+main(int argc, char **argv)
+{
+	double mhz, pcyc, ucyc, rate, cpu, saved;
+	int j, zblk;
+
+	mhz = 4;
+	pcyc = 80;
+	ucyc = 30;
+	rate = 0;
+	while (argc > 2 && argv[1][0] == '-' && argv[1][2] == '\0') {
+		switch (argv[1][1]) {
+		case 'm':
+			mhz = atof(argv[2]);
+			break;
+		case 'p':
+			pcyc = atof(argv[2]);
+			break;
+		case 'u':
+			ucyc = atof(argv[2]);
+			break;
+		case 'r':
+			rate = atof(argv[2]);
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2 || mhz <= 0) {
+		fprintf(stderr, "usage: swzbench [-m mhz] [-p cycles] "
+		    "[-u cycles] [-r kbps] file ...\n");
+		exit(2);
+	}
+
+	printf("%-16s %6s %5s %6s %8s %10s", "image", "used", "raw", "packed",
+	    "cpu ms", "cross KB/s");
+	if (rate)
+		printf(" %9s", "saved ms");
+	printf("\n");
+	for (j = 1; j < argc; ++j) {
+		if (load(argv[j]) < 0)
+			continue;
+		zblk = pack();
+		cpu = IMAGE * (pcyc + ucyc) / (mhz * 1000);
+		if (zblk) {
+			unpack(zblk);
+			if (memcmp(image, back, IMAGE) != 0) {
+				fprintf(stderr, "swzbench: %s does not unpack\n",
+				    argv[j]);
+				exit(1);
+			}
+		}
+		printf("%-16.16s %6ld %5d ", argv[j], used, NBLK);
+		if (!zblk) {
+			printf("%6s %8s %10s", "-", "-", "never");
+			if (rate)
+				printf(" %9s", "-");
+			printf("\n");
+			continue;
+		}
+		/* Blocks saved going out and coming back in. */
+		saved = 2.0 * (NBLK - zblk) * 512 / 1024;
+		printf("%6d %8.0f %10.1f", zblk, cpu, saved / (cpu / 1000));
+		if (rate)
+			printf(" %9.0f", saved / rate * 1000 - cpu);
+		printf("\n");
+	}
+	exit(0);
+}
+
+/*
+ * load lays the file out as an image.
+ */
+static int
+load(char *path)
+{
+	FILE *f;
+	long n;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "swzbench: can't open %s\n", path);
+		return (-1);
+	}
+	memset(image, 0, IMAGE);
+	n = fread(image, 1, IMAGE - 1024, f);
+	fclose(f);
+	memcpy(image + IMAGE - 1024, image, 1024);
+	used = n;
+	return (0);
+}
+
+/*
+ * pack packs the image into disk[] as swzwrite() does, and returns
+ * the blocks it took, or 0 if it would take as many as it is.
+ */
+static int
+pack(void)
+{
+	char *p;
+	int k;
+
+	p = image;
+	for (k = 0; p < image + IMAGE; ++k) {
+		if (k + 1 >= NBLK)
+			return (0);
+		memset(disk[k], 0xe5, 512);	/* Garbage past the codes. */
+		zpack(&p, image + IMAGE, disk[k], 512);
+	}
+	return (k);
+}
+
+static void
+unpack(int zblk)
+{
+	char *q;
+	int k;
+
+	memset(back, 0xe5, IMAGE);
+	q = back;
+	for (k = 0; k < zblk; ++k)
+		q = zunpack(disk[k], 512, q, back + IMAGE);
+}
@@ -0,0 +1,780 @@
+/**************************************************
+UZI (Unix Z80 Implementation) Kernel:  host/uzihost.c
+***************************************************/
+
+/*
+ * uzihost runs the kernel as a host process, on a disk image, and
+ * makes system calls for it from a script.  -m loads an image into
+ * the RAM disk first.  Script lines are:
+ *
+ *	mkdir path
+ *	mknod path mode dev		(mode in octal)
+ *	write path kbytes [bufsize]	(creat, then write a pattern)
+ *	append path kbytes [bufsize]
+ *	read path [bufsize]		(read to the end, checking the pattern)
+ *	rm path
+ *	stat path
+ *	mount special dir [flags]	(1 read-only, 2 noatime)
+ *	umount special
+ *	sync
+ *	fsync path			(open the file, fsync it and close it)
+ *	opens path count		(open and close the file count times)
+ *	pipe kbytes			(pass kbytes through a pipe, 512 at a time)
+ *	stats label			(print the counters, and clear them)
+ *	calls label			(print what each call has cost, and clear)
+ *	kstat path			(read and print the kernel's counters)
+ *	profile start|stop|print	(the kernel profile; see kprof.c)
+ *	rusage				(print this process's resource usage)
+ *	ktrace path|off			(print the trace read from path; see ktsum.c)
+ *	latency calls			(how long the disk takes on its own)
+ *	think calls			(how long the program runs between calls)
+ *	fails command ...		(the command, which must fail)
+ *	tick n				(let n clock ticks go by, 10 a second)
+ *
+ * Blank lines and lines starting with # are ignored.
+ */
+
+#include "unix.h"
+#include "extern.h"
+
+/* System call numbers, from the order of disp_tab[]. */
+#define SYS_open	1
+#define SYS_close	2
+#define SYS_creat	3
+#define SYS_mknod	4
+#define SYS_link	5
+#define SYS_unlink	6
+#define SYS_read	7
+#define SYS_write	8
+#define SYS_sync	11
+#define SYS_stat	15
+#define SYS_mount	33
+#define SYS_umount	34
+#define SYS_pipe	40
+#define SYS_lseek	43
+#define SYS_profil	44
+#define SYS_getrusage	45
+#define SYS_fsync	46
+
+#define NSYS		47
+#define MAXARGS		6
+#define MAXBUF		16384
+
+#define sys1(n, a)	sys(n, 0, 0, 0, (int)(long)(a))
+#define sys2(n, a, b)	sys(n, 0, 0, (int)(long)(a), (int)(long)(b))
+#define sys3(n, a, b, c) sys(n, 0, (int)(long)(a), (int)(long)(b), \
+			    (int)(long)(c))
+
+extern void	exit(int);
+
+extern int	hostinit(void);
+extern int	hostdisk(char *);
+extern int	hostscript(char *);
+extern int	hostram(char *);
+extern int	hostgets(char *, int);
+extern long	hostusec(void);
+extern int	scsiint(void);
+extern void	spin(void);
+extern void	idle(void);
+extern void	hostthink(long);
+extern int	hosttick(int);
+
+extern char *	hostmem;
+extern char	__executable_start[], etext[];
+extern long	hd_nread, hd_nwrite, hd_rblk, hd_wblk, hd_seek;
+extern long	hd_nasync, hd_nspin, hd_latency;
+extern long	hk_calls, hk_bytes;
+
+extern void	init2(void);
+extern int	unix(int, int, int, int, char *, int);
+extern void	kprintf();
+
+int		main(int, char **);
+
+static int	run(int, char **);
+static int	sys(int, int, int, int, int);
+static int	mkdir(char *);
+static int	wrfile(char *, long, int, int);
+static int	rdfile(char *, int);
+static int	opens(char *, long);
+static int	fsync(char *);
+static int	pipe(long);
+static void	stats(char *);
+static void	calls(char *);
+static int	kstats(char *);
+static int	profile(char *);
+static int	rusage(void);
+static int	ktrace(char *);
+static void	ktdrain(void);
+static char *	upath(int, char *);
+static int	split(char *, char **);
+static long	num(char *, int);
+static int	same(char *, char *);
+static char	pat(long);
+static char *	scat(char *, char *, char *);
+
+static long	t0;
+static long	think;		/* Calls' worth of time between system calls. */
+
+static int	ktfd = -1;	/* The trace device, while tracing. */
+static int	ktcalls;	/* Calls since it was last drained. */
+static int	ktbusy;
+
+/*
+ * What each system call has cost, in work that is the same from run
+ * to run: kernel function calls, bytes copied or cleared, and disk
+ * commands and blocks.
+ */
+static struct callstat {
+	long	c_n;
+	long	c_fn;
+	long	c_bytes;
+	long	c_cmds;
+	long	c_blks;
+} callstat[NSYS];
+
+static char *	callname[NSYS] = {
+	"exit", "open", "close", "creat", "mknod", "link", "unlink",
+	"read", "write", "seek", "chdir", "sync", "access", "chmod",
+	"chown", "stat", "fstat", "dup", "getpid", "getppid", "getuid",
+	"umask", "getfsys", "execve", "wait", "setuid", "setgid", "time",
+	"stime", "ioctl", "brk", "sbrk", "fork", "mount", "umount",
+	"signal", "dup2", "pause", "alarm", "kill", "pipe", "getgid",
+	"times", "lseek", "profil", "getrusage", "fsync"
+};
+
+int
+main(int argc, char **argv)
+{
+	char line[256];
+	char *av[MAXARGS];
+	int ac;
+	int lineno;
+	int err;
+
+	ROOTDEV = 0;
+	if (argc > 2 && same(argv[1], "-r")) {
+		ROOTDEV = num(argv[2], 10);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc > 2 && same(argv[1], "-m")) {
+		if (hostram(argv[2]) < 0) {
+			kprintf("uzihost: can't load %s\n", argv[2]);
+			exit(2);
+		}
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc != 3) {
+		kprintf("usage: uzihost [-r rootdev] [-m ramimage] "
+		    "image script\n");
+		exit(2);
+	}
+	if (hostinit() < 0 || hostdisk(argv[1]) < 0) {
+		kprintf("uzihost: can't open %s\n", argv[1]);
+		exit(2);
+	}
+	if (hostscript(argv[2]) < 0) {
+		kprintf("uzihost: can't open %s\n", argv[2]);
+		exit(2);
+	}
+
+	init2();
+	stats(NULL);
+
+	err = 0;
+	for (lineno = 1; hostgets(line, sizeof(line)); ++lineno) {
+		ac = split(line, av);
+		if (ac == 0 || av[0][0] == '#')
+			continue;
+		if (run(ac, av) < 0) {
+			kprintf("line %d: %s: error %d\n", lineno, av[0],
+			    udata.u_error);
+			err = 1;
+			break;
+		}
+	}
+	sys1(SYS_sync, 0);
+	exit(err);
+}
+
+/*
+ * run carries out one script command.
+ */
+static int
+run(int ac, char **av)
+{
+	struct stat *st;
+
+	if (same(av[0], "mkdir") && ac == 2)
+		return (mkdir(av[1]));
+	if (same(av[0], "mknod") && ac == 4)
+		return (sys3(SYS_mknod, upath(0, av[1]),
+		    (int16)num(av[2], 8), (int16)num(av[3], 10)));
+	if (same(av[0], "write") && (ac == 3 || ac == 4))
+		return (wrfile(av[1], num(av[2], 10),
+		    ac == 4 ? num(av[3], 10) : 512, 0));
+	if (same(av[0], "append") && (ac == 3 || ac == 4))
+		return (wrfile(av[1], num(av[2], 10),
+		    ac == 4 ? num(av[3], 10) : 512, 1));
+	if (same(av[0], "read") && (ac == 2 || ac == 3))
+		return (rdfile(av[1], ac == 3 ? num(av[2], 10) : 512));
+	if (same(av[0], "rm") && ac == 2)
+		return (sys1(SYS_unlink, upath(0, av[1])));
+	if (same(av[0], "stat") && ac == 2) {
+		st = (struct stat *)(hostmem + 512);
+		if (sys2(SYS_stat, upath(0, av[1]), st) < 0)
+			return (-1);
+		kprintf("%s: ino %u mode 0%o nlink %d size %u\n", av[1],
+		    st->st_ino, st->st_mode, st->st_nlink,
+		    (unsigned)(st->st_size.o_blkno * 512 +
+		    st->st_size.o_offset));
+		return (0);
+	}
+	if (same(av[0], "mount") && (ac == 3 || ac == 4))
+		return (sys3(SYS_mount, upath(0, av[1]), upath(1, av[2]),
+		    ac == 4 ? num(av[3], 10) : 0));
+	if (same(av[0], "umount") && ac == 2)
+		return (sys1(SYS_umount, upath(0, av[1])));
+	if (same(av[0], "sync") && ac == 1) {
+		sys1(SYS_sync, 0);	/* sync() returns nothing. */
+		return (0);
+	}
+	if (same(av[0], "fsync") && ac == 2)
+		return (fsync(av[1]));
+	if (same(av[0], "opens") && ac == 3)
+		return (opens(av[1], num(av[2], 10)));
+	if (same(av[0], "pipe") && ac == 2)
+		return (pipe(num(av[1], 10)));
+	if (same(av[0], "stats") && ac == 2) {
+		stats(av[1]);
+		return (0);
+	}
+	if (same(av[0], "calls") && ac == 2) {
+		calls(av[1]);
+		return (0);
+	}
+	if (same(av[0], "kstat") && ac == 2)
+		return (kstats(av[1]));
+	if (same(av[0], "profile") && ac == 2)
+		return (profile(av[1]));
+	if (same(av[0], "rusage") && ac == 1)
+		return (rusage());
+	if (same(av[0], "ktrace") && ac == 2)
+		return (ktrace(av[1]));
+	if (same(av[0], "latency") && ac == 2) {
+		hd_latency = num(av[1], 10);
+		return (0);
+	}
+	if (same(av[0], "fails") && ac > 1) {
+		if (run(ac - 1, av + 1) < 0) {
+			kprintf("%s: error %d, as expected\n", av[1],
+			    udata.u_error);
+			udata.u_error = 0;
+			return (0);
+		}
+		kprintf("%s: did not fail\n", av[1]);
+		udata.u_error = EINVAL;
+		return (-1);
+	}
+	if (same(av[0], "tick") && ac == 2) {
+		hosttick(num(av[1], 10));
+		while (hosttick(0))
+			idle();
+		return (0);
+	}
+	if (same(av[0], "think") && ac == 2) {
+		think = num(av[1], 10);
+		return (0);
+	}
+	kprintf("bad command: %s\n", av[0]);
+	udata.u_error = EINVAL;
+	return (-1);
+}
+
+/*
+ * sys makes a system call the way the user library does, and counts
+ * what it cost.  The last argument of the call goes in argn.
+ */
+static int
+sys(int callno, int argn3, int argn2, int argn1, int argn)
+{
+	struct callstat *cp;
+	long fn, bytes, cmds, blks;
+	int r;
+
+	/* The program has been running since the last call. */
+	hostthink(think);
+	if (scsiint())
+		spin();
+
+	fn = hk_calls;
+	bytes = hk_bytes;
+	cmds = hd_nread + hd_nwrite;
+	blks = hd_rblk + hd_wblk;
+	r = unix(argn3, argn2, argn1, argn, NULL, callno);
+	cp = &callstat[callno];
+	++cp->c_n;
+	cp->c_fn += hk_calls - fn;
+	cp->c_bytes += hk_bytes - bytes;
+	cp->c_cmds += hd_nread + hd_nwrite - cmds;
+	cp->c_blks += hd_rblk + hd_wblk - blks;
+	if (udata.u_error)
+		r = -1;
+
+	/* Take the disk's interrupt if it came while in the kernel. */
+	if (scsiint())
+		spin();
+
+	/* Keep ahead of the trace ring, so that nothing is lost. */
+	if (ktfd >= 0 && !ktbusy && ++ktcalls >= NKTRACE / 2)
+		ktdrain();
+	return (r);
+}
+
+/*
+ * mkdir makes a directory and its . and .. entries.
+ */
+static int
+mkdir(char *path)
+{
+	char name[256];
+	char parent[256];
+	int k;
+
+	if (sys3(SYS_mknod, upath(0, path), F_DIR | 0777, 0) < 0)
+		return (-1);
+
+	/* The parent is what comes before the last slash. */
+	for (k = 0; (parent[k] = path[k]) != '\0'; ++k)
+		;
+	while (k > 0 && parent[k - 1] != '/')
+		--k;
+	if (k > 1)
+		--k;
+	if (k == 0)
+		parent[k++] = '.';
+	parent[k] = '\0';
+
+	if (sys2(SYS_link, upath(0, path),
+	    upath(1, scat(name, path, "/."))) < 0)
+		return (-1);
+	return (sys2(SYS_link, upath(0, parent),
+	    upath(1, scat(name, path, "/.."))));
+}
+
+/*
+ * wrfile writes kbytes of the pattern to the file, creating it or
+ * appending to it.
+ */
+static int
+wrfile(char *path, long kbytes, int bufsize, int append)
+{
+	char *buf;
+	uint32 *offp;
+	long off;
+	long left;
+	int fd;
+	int n;
+	int j;
+
+	if (bufsize <= 0 || bufsize > MAXBUF) {
+		udata.u_error = EINVAL;
+		return (-1);
+	}
+	buf = hostmem + 1024;
+	off = 0;
+	if (append) {
+		if ((fd = sys2(SYS_open, upath(0, path), O_WRONLY)) < 0)
+			return (-1);
+		offp = (uint32 *)(hostmem + 512);
+		*offp = 0;
+		if (sys3(SYS_lseek, fd, offp, 2) < 0)
+			return (-1);
+		off = *offp;
+	} else if ((fd = sys2(SYS_creat, upath(0, path), 0666)) < 0)
+		return (-1);
+
+	for (left = kbytes * 1024; left > 0; left -= n) {
+		n = left < bufsize ? left : bufsize;
+		for (j = 0; j < n; ++j)
+			buf[j] = pat(off + j);
+		if (sys3(SYS_write, fd, buf, n) != n)
+			return (-1);
+		off += n;
+	}
+	return (sys1(SYS_close, fd));
+}
+
+/*
+ * rdfile reads the file to its end, and reports any bytes that do
+ * not match the pattern.
+ */
+static int
+rdfile(char *path, int bufsize)
+{
+	char *buf;
+	long off;
+	long bad;
+	int fd;
+	int n;
+	int j;
+
+	if (bufsize <= 0 || bufsize > MAXBUF) {
+		udata.u_error = EINVAL;
+		return (-1);
+	}
+	buf = hostmem + 1024;
+	if ((fd = sys2(SYS_open, upath(0, path), O_RDONLY)) < 0)
+		return (-1);
+	off = bad = 0;
+	while ((n = sys3(SYS_read, fd, buf, bufsize)) > 0) {
+		for (j = 0; j < n; ++j)
+			if (buf[j] != pat(off + j))
+				++bad;
+		off += n;
+	}
+	if (n < 0)
+		return (-1);
+	if (bad) {
+		kprintf("read %s: %d of %d bytes bad\n", path, (int)bad,
+		    (int)off);
+		udata.u_error = EIO;
+		return (-1);
+	}
+	return (sys1(SYS_close, fd));
+}
+
+/*
+ * opens opens and closes a file count times.
+ */
+static int
+opens(char *path, long count)
+{
+	int fd;
+
+	while (count-- > 0) {
+		if ((fd = sys2(SYS_open, upath(0, path), O_RDONLY)) < 0)
+			return (-1);
+		if (sys1(SYS_close, fd) < 0)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * fsync writes out the file's dirty blocks, and no one else's.
+ */
+static int
+fsync(char *path)
+{
+	int fd;
+	int r;
+
+	if ((fd = sys2(SYS_open, upath(0, path), O_RDONLY)) < 0)
+		return (-1);
+	r = sys1(SYS_fsync, fd);
+	if (sys1(SYS_close, fd) < 0)
+		return (-1);
+	return (r);
+}
+
+/*
+ * pipe writes kbytes of the pattern into a pipe and reads it back
+ * out, a block at a time so that the writer never has to wait.
+ */
+static int
+pipe(long kbytes)
+{
+	int *fds;
+	char *buf;
+	long off;
+	int j;
+
+	fds = (int *)(hostmem + 512);
+	buf = hostmem + 1024;
+	if (sys1(SYS_pipe, fds) < 0)
+		return (-1);
+	for (off = 0; off < kbytes * 1024; off += 512) {
+		for (j = 0; j < 512; ++j)
+			buf[j] = pat(off + j);
+		if (sys3(SYS_write, fds[1], buf, 512) != 512)
+			return (-1);
+		bzero(buf, 512);
+		if (sys3(SYS_read, fds[0], buf, 512) != 512)
+			return (-1);
+		for (j = 0; j < 512; ++j)
+			if (buf[j] != pat(off + j)) {
+				kprintf("pipe: bad data at %d\n", (int)off);
+				udata.u_error = EIO;
+				return (-1);
+			}
+	}
+	if (sys1(SYS_close, fds[0]) < 0)
+		return (-1);
+	return (sys1(SYS_close, fds[1]));
+}
+
+/*
+ * stats prints the disk counters and CPU time since the last call,
+ * and starts them again.
+ */
+static void
+stats(char *label)
+{
+	long t;
+
+	t = hostusec();
+	if (label)
+		kprintf("%s: read %d cmds %d blks, write %d cmds %d blks, "
+		    "seek %d blks, %d async %d waits, %d ms\n", label,
+		    (int)hd_nread, (int)hd_rblk, (int)hd_nwrite, (int)hd_wblk,
+		    (int)hd_seek, (int)hd_nasync, (int)hd_nspin,
+		    (int)((t - t0) / 1000));
+	hd_nread = hd_rblk = hd_nwrite = hd_wblk = hd_seek = 0;
+	hd_nasync = hd_nspin = 0;
+	t0 = t;
+}
+
+/*
+ * calls prints, for each system call made since the last time, how
+ * often it was made and what it cost on average, and starts again.
+ */
+static void
+calls(char *label)
+{
+	struct callstat *cp;
+	int j;
+
+	kprintf("%s:\tcalls\tfn\tbytes\tcmds\tblks\n", label);
+	for (j = 0; j < NSYS; ++j) {
+		cp = &callstat[j];
+		if (cp->c_n == 0)
+			continue;
+		kprintf("%s\t%d\t%d\t%d\t%d.%d\t%d.%d\n", callname[j],
+		    (int)cp->c_n, (int)(cp->c_fn / cp->c_n),
+		    (int)(cp->c_bytes / cp->c_n),
+		    (int)(cp->c_cmds / cp->c_n),
+		    (int)(cp->c_cmds * 10 / cp->c_n % 10),
+		    (int)(cp->c_blks / cp->c_n),
+		    (int)(cp->c_blks * 10 / cp->c_n % 10));
+		bzero(cp, sizeof(*cp));
+	}
+}
+
+/*
+ * kstats reads the kernel's counters from the kstat device, and
+ * prints those for the buffers, inodes and disk.
+ */
+static int
+kstats(char *path)
+{
+	struct kstat *ks;
+	int fd;
+
+	ks = (struct kstat *)(hostmem + 1024);
+	if ((fd = sys2(SYS_open, upath(0, path), O_RDONLY)) < 0)
+		return (-1);
+	if (sys3(SYS_read, fd, ks, sizeof(*ks)) != sizeof(*ks))
+		return (-1);
+	kprintf("%s: bufs %u hit %u miss %u dirty, inodes %u hit %u miss, "
+	    "%u disk cmds\n", path, ks->ks_bhit, ks->ks_bmiss, ks->ks_bdirty,
+	    ks->ks_ihit, ks->ks_imiss, ks->ks_dcmd);
+	if (ks->ks_fdtrk)
+		kprintf("%s: %u floppy tracks in %u turns\n", path,
+		    ks->ks_fdtrk, ks->ks_fdrot);
+	if (ks->ks_swapout)
+		kprintf("%s: swap %u bytes in %u out, %u blocks unchanged, "
+		    "%u images compressed\n", path, ks->ks_swapin,
+		    ks->ks_swapout, ks->ks_swsame, ks->ks_swz);
+	if (ks->ks_schit + ks->ks_scmiss)
+		kprintf("%s: swap cache %u hit %u miss %u flushed\n", path,
+		    ks->ks_schit, ks->ks_scmiss, ks->ks_scflush);
+	return (sys1(SYS_close, fd));
+}
+
+/*
+ * profile starts the kernel profile over the whole program's text,
+ * stops it, or prints it as lines of
+ *
+ *	pc address ticks
+ *
+ * for kprof to match up with the symbol table.
+ */
+static int
+profile(char *cmd)
+{
+	struct kprof *kp;
+	int shift;
+	int j;
+
+	if (same(cmd, "start")) {
+		for (shift = 0; (etext - __executable_start) >> shift >= NPROF;
+		    ++shift)
+			;
+		return (sys3(SYS_profil, PROF_START, __executable_start,
+		    shift));
+	}
+	if (same(cmd, "stop"))
+		return (sys3(SYS_profil, PROF_STOP, 0, 0));
+	if (same(cmd, "print")) {
+		kp = (struct kprof *)(hostmem + 1024);
+		if (sys3(SYS_profil, PROF_READ, kp, sizeof(*kp)) < 0)
+			return (-1);
+		kprintf("profile: user %u out %u shift %d\n",
+		    (unsigned)kp->pr_user, (unsigned)kp->pr_out, kp->pr_shift);
+		for (j = 0; j < NPROF; ++j)
+			if (kp->pr_hist[j])
+				kprintf("pc %x %u\n", (unsigned)(long)(kp->pr_base +
+				    (j << kp->pr_shift)), kp->pr_hist[j]);
+		return (0);
+	}
+	udata.u_error = EINVAL;
+	return (-1);
+}
+
+static int
+rusage(void)
+{
+	struct rusage *ru;
+
+	ru = (struct rusage *)(hostmem + 512);
+	if (sys2(SYS_getrusage, RUSAGE_SELF, ru) < 0)
+		return (-1);
+	kprintf("rusage: %u blocks in, %u out, %u syscalls, "
+	    "%u/%u swaps in/out, %u/%u switches vol/invol\n",
+	    ru->ru_inblock, ru->ru_oublock, ru->ru_nsyscall, ru->ru_nswapin,
+	    ru->ru_nswapout, ru->ru_nvcsw, ru->ru_nivcsw);
+	return (0);
+}
+
+/*
+ * ktrace starts printing the system call trace, read from the given
+ * device, or stops it.
+ */
+static int
+ktrace(char *path)
+{
+	if (ktfd >= 0) {
+		ktdrain();
+		sys1(SYS_close, ktfd);
+		ktfd = -1;
+	}
+	if (same(path, "off"))
+		return (0);
+	if ((ktfd = sys2(SYS_open, upath(0, path), O_RDONLY)) < 0)
+		return (-1);
+	ktdrain();
+	return (0);
+}
+
+/*
+ * ktdrain reads the trace ring dry, and prints the records as
+ *
+ *	kt seq call pid retval error start end
+ *
+ * with its own reads named "-".
+ */
+static void
+ktdrain(void)
+{
+	struct ktrec *kp;
+	int error;
+	int n;
+
+	ktbusy = 1;
+	error = udata.u_error;
+	kp = (struct ktrec *)(hostmem + 1024 + MAXBUF);
+	n = sys3(SYS_read, ktfd, kp, NKTRACE * sizeof(*kp));
+	for (; n >= (int)sizeof(*kp); n -= sizeof(*kp), ++kp)
+		kprintf("kt %u %s %d %d %d %u %u\n", kp->kt_seq,
+		    kp->kt_callno == SYS_read && kp->kt_arg[1] == ktfd ? "-" :
+		    (unsigned char)kp->kt_callno < NSYS ?
+		    callname[(unsigned char)kp->kt_callno] : "?",
+		    kp->kt_pid, kp->kt_retval, kp->kt_error,
+		    (unsigned)kp->kt_start, (unsigned)kp->kt_end);
+	udata.u_error = error;
+	ktcalls = 0;
+	ktbusy = 0;
+}
+
+/*
+ * upath copies a path into one of two slots in user memory.
+ */
+static char *
+upath(int slot, char *s)
+{
+	char *p;
+	char *d;
+
+	d = p = hostmem + 256 * slot;
+	while ((*d++ = *s++) != '\0')
+		if (d == p + 255)
+			break;
+	*d = '\0';
+	return (p);
+}
+
+/*
+ * split breaks a line into words, in place.
+ */
+static int
+split(char *line, char **av)
+{
+	int ac;
+
+	ac = 0;
+	for (;;) {
+		while (*line == ' ' || *line == '\t')
+			*line++ = '\0';
+		if (*line == '\0' || ac == MAXARGS)
+			return (ac);
+		av[ac++] = line;
+		while (*line && *line != ' ' && *line != '\t')
+			++line;
+	}
+}
+
+static long
+num(char *s, int base)
+{
+	long n;
+
+	for (n = 0; *s >= '0' && *s <= '9'; ++s)
+		n = n * base + *s - '0';
+	return (n);
+}
+
+static int
+same(char *s, char *t)
+{
+	while (*s == *t++)
+		if (*s++ == '\0')
+			return (1);
+	return (0);
+}
+
+/*
+ * scat puts the concatenation of a and b in d.
+ */
+static char *
+scat(char *d, char *a, char *b)
+{
+	char *p;
+
+	for (p = d; (*p = *a++) != '\0'; ++p)
+		;
+	while ((*p++ = *b++) != '\0')
+		;
+	return (d);
+}
+
+/*
+ * pat is the byte at the given offset of a test file.
+ */
+static char
+pat(long off)
+{
+	return (off ^ (off >> 9) ^ (off >> 17));
+}
@@ -4,6 +4,9 @@ UZI (Unix Z80 Implementation) Kernel:  machdep.c
 
 #include "unix.h"
 #include "extern.h"
+#ifdef HOSTED
+#include <stdarg.h>
+#endif
 
 /*
  * Port addresses of clock chip registers.
@@ -21,6 +24,8 @@ extern void	abort(void);
 static int	cursig;
 static int	(*curvec)();
 
+char *		intpc;		/* Where the last interrupt came in. */
+
 int		main(void);
 int		valadr(char *, uint16);
 void		addtick(time_t *, time_t *);
@@ -28,11 +33,17 @@ void		incrtick(time_t *);
 
 static void	stkreset(void);
 void		tempstack(void);
+#ifndef HOSTED
+void		setbank(int);
+void		frombank(int, char *, char *, unsigned int);
+void		tobank(int, char *, char *, unsigned int);
+#endif
 static void	initvec(void);
 void		doexec(void);
 static void	service(void);
 void		di(void);
 void		ei(void);
+void		spin(void);
 static void	shift8(void);
 
 void		calltrap(void);
@@ -45,12 +56,23 @@ void		warning(char *);
 void		puts(char *);
 void		kputchar(int);
 void		idump(void);
+#ifdef HOSTED
+void		kprintf(char *, ...);
+void		idle(void);
+
+extern char *	hostmem;	/* The user's 32K, from host/hostdev.c. */
+extern void	hostwait(void);
+extern int	scsiwait(void);
+#else
 void		kprintf();
+#endif
 
 /*
  * main() is called at the very beginning to initialize everything.
  * It used to be called fs_init(). Initial entry is from a jump in data.c.
+ * The hosted build has its own main() in host/uzihost.c.
  */
+#ifndef HOSTED
 int
 main(void)
 {
@@ -64,6 +86,7 @@ main(void)
 
 	init2();	/* From process.c */
 }
+#endif
 
 /*
  * valadr checks to see if a user-suppled address is legitimate.
@@ -71,7 +94,11 @@ main(void)
 int
 valadr(char *base, uint16 size)
 {
+#ifdef HOSTED
+	if (base < hostmem || base + size > hostmem + 0x8000) {
+#else
 	if (base < PROGBASE || base + size >= (char *)&udata) {
+#endif
 		udata.u_error = EFAULT;
 		return (0);
 	}
@@ -117,18 +144,109 @@ stkreset(void)
 #endif
 }
 
+/*
+ * tempstack moves the stack out of the way of the process being
+ * swapped in: below it in page zero, or with NBANKS, into the
+ * kernel's half, where it stays put while the banks are switched.
+ * exec2() and the whole swap I/O chain run on it, down through
+ * scflush(), bwait() and the disk driver to scsiop(), with an
+ * interrupt's service() frame on top; TMPSTK must cover all that.
+ */
+#if NBANKS
+static char	tmpstk[TMPSTK];
+#endif
+
 void
 tempstack(void)
 {
 #if 0	/* XXX - Comment out temporarily. */
 #asm 8080
 	POP	H
+#if NBANKS
+	LXI	SP,tmpstk?+TMPSTK
+#else
 	LXI	SP,100H
+#endif
 	PCHL
 #endasm
 #endif
 }
 
+#ifndef HOSTED
+/*
+ * setbank switches bank in at 0..0x7fff.  The caller must not be
+ * on a stack there.
+ */
+void
+setbank(int bank)
+{
+	out(bank, 0x70);	/* Bank select port. */
+}
+
+/*
+ * frombank copies n bytes from src, in the user's half of memory in
+ * the given bank, to dst in the kernel's half; tobank copies the
+ * other way.  The kernel's stack is in the user's half too, so the
+ * bank is switched in and ubank put back with interrupts off and
+ * nothing pushed in between.
+ */
+void
+frombank(int bank, char *src, char *dst, unsigned int n)
+{
+#if 0	/* XXX - Comment out temporarily. */
+#asm 8080
+.Z80
+	PUSH	IX
+	LD	IX,4
+	ADD	IX,SP
+	LD	C,(IX+0)	;n
+	LD	B,(IX+1)
+	LD	E,(IX+2)	;dst
+	LD	D,(IX+3)
+	LD	L,(IX+4)	;src
+	LD	H,(IX+5)
+	LD	A,(IX+6)	;bank
+	POP	IX
+	DI
+	OUT	(70H),A		;Bank select port.
+	LDIR
+	LD	A,(ubank?)
+	OUT	(70H),A
+.8080
+	CALL	ei?
+#endasm
+#endif
+}
+
+void
+tobank(int bank, char *src, char *dst, unsigned int n)
+{
+#if 0	/* XXX - Comment out temporarily. */
+#asm 8080
+.Z80
+	PUSH	IX
+	LD	IX,4
+	ADD	IX,SP
+	LD	C,(IX+0)	;n
+	LD	B,(IX+1)
+	LD	E,(IX+2)	;dst
+	LD	D,(IX+3)
+	LD	L,(IX+4)	;src
+	LD	H,(IX+5)
+	LD	A,(IX+6)	;bank
+	POP	IX
+	DI
+	OUT	(70H),A		;Bank select port.
+	LDIR
+	LD	A,(ubank?)
+	OUT	(70H),A
+.8080
+	CALL	ei?
+#endasm
+#endif
+}
+#endif
+
 static void
 initvec(void)
 {
@@ -189,6 +307,13 @@ service(void)
 	PUSH	IX
 	PUSH	IY
 .8080
+	LXI	H,12
+	DAD	SP
+	MOV	E,M
+	INX	H
+	MOV	D,M
+	XCHG
+	SHLD	intpc?	;The return address is the interrupted PC.
 #endasm
 #endif
 
@@ -196,6 +321,8 @@ service(void)
 
 	if (tty_int())
 		goto found;
+	if (wd_int())
+		goto found;
 	if (clk_int())
 		goto found;
 /* XXX - if (  ) ... */
@@ -223,6 +350,19 @@ found:
 #endif
 }
 
+#ifdef HOSTED
+/*
+ * idle is called by getproc() when nothing is runnable.  It waits
+ * for the host to have a simulated interrupt ready, and services it.
+ */
+void
+idle(void)
+{
+	hostwait();
+	service();
+}
+#endif
+
 void
 calltrap(void)
 {
@@ -310,6 +450,23 @@ ei(void)
 #endif
 }
 
+/*
+ * spin is called over and over by the kernel while it waits for an
+ * interrupt to change something.  The host only interrupts when it
+ * is asked to, so there it has the disk finish what it is doing and
+ * services the interrupt.
+ */
+void
+spin(void)
+{
+#ifdef HOSTED
+	if (scsiwait())
+		service();
+#else
+	ei();
+#endif
+}
+
 /*
  * shift8 shifts an unsigned int right 8 places.
  */
@@ -386,7 +543,7 @@ idump(void)
 		kprintf("%d\t%d\t%d\t%u\t0%o\t%d\t%d\t%d\t%d\n",
 		    ip - i_tab, ip->c_magic, ip->c_dev, ip->c_num,
 		    ip->c_node.i_mode, ip->c_node.i_nlink,
-		    ip->c_node.i_addr[0], ip->c_refs, ip->c_dirty);
+		    (int)ip->c_node.i_addr[0], ip->c_refs, ip->c_dirty);
 
 		/****** XXX - Why is this commented out
 		ifnot (ip->c_magic)     
@@ -413,7 +570,53 @@ idump(void)
 
 /*
  * kprintf is a short version of printf to save space.
+ * The compiler passes it the number of arguments first; the hosted
+ * build uses stdarg instead.
  */
+#ifdef HOSTED
+void
+kprintf(char *fmt, ...)
+{
+	va_list ap;
+	char s[12];
+	char *itob();
+	int c, base;
+
+	va_start(ap, fmt);
+	while ((c = *fmt++) != 0) {
+		if (c != '%') {
+			kputchar(c);
+			continue;
+		}
+		switch (c = *fmt++) {
+		case 'c':
+			kputchar(va_arg(ap, int));
+			continue;
+		case 'd':
+			base = -10;
+			goto prt;
+		case 'o':
+			base = 8;
+			goto prt;
+		case 'u':
+			base = 10;
+			goto prt;
+		case 'x':
+			base = 16;
+prt:
+			puts(itob(va_arg(ap, int), s, base));
+			continue;
+		case 's':
+			puts(va_arg(ap, char *));
+			continue;
+		default:
+			kputchar(c);
+			continue;
+		}
+	}
+	va_end(ap);
+}
+#else
 void
 kprintf(nargs)
 {
@@ -457,3 +660,4 @@ prt:
 		}
 	}
 }
+#endif
@@ -14,21 +14,100 @@ ptptr		getproc(void);
 void		swapin(ptptr);
 int		dofork(void);
 int		clk_int(void);
-int		unix(int16, int16, int16, int16, char *, int);
+int		unix(int, int, int, int, char *, int);
 void		chksigs(void);
 void		sendsig(ptptr, int16);
 void		ssig(ptptr, int16);
 
 static int	swapout(void);
 static void	swrite(void);
+static void	swdisk(void);
+static uint32	blksum(char *);
+static void	swsums(void);
+void		swstale(void);
+#if SWAPZ
+static int	swzwrite(void);
+static void	swzread(ptptr);
+
+extern int	zpack(char **, char *, char *, int);
+extern char *	zunpack(char *, int, char *, char *);
+
+static char	swzbuf[512];	/* One block of a compressed image. */
+#endif
 static void	newproc(ptptr);
+static void	writeback(void);
 static ptptr	ptab_alloc(void);
+#if NBANKS || NSWCACHE
+static void	bankcopy(int, int, char *, unsigned int);
+
+extern void	frombank(int, char *, char *, unsigned int);
+extern void	tobank(int, char *, char *, unsigned int);
+#endif
+#if NBANKS
+static int	bankmove(void);
+static int	bankalloc(ptptr);
+
+extern void	setbank(int);
+
+/*
+ * Processes with a bank of their own stay in memory when switched
+ * out, with their udata kept here.  The rest share bank 0 and are
+ * swapped.
+ */
+static ptptr	bankp[NBANKS];	/* Which process has each bank. */
+static u_data	ubsave[NBANKS];
+#endif
+#if NSWCACHE
+static int	scput(void);
+static int	scget(ptptr);
+static void	scflush(int);
+
+#define SCBANK	(PBANK + NBANKS)
+
+/*
+ * The swap cache keeps the images of the last few processes swapped
+ * out, in banks SCBANK on, and their udata here, so that one switched
+ * back in soon is a copy from memory.  An image goes to swap only
+ * when it is the least recently cached and room is needed.
+ */
+static struct swcache {
+	ptptr	sc_proc;	/* The process it holds, or NULL. */
+	uint16	sc_when;	/* scclock when it was put there. */
+	u_data	sc_udata;
+} swcache[NSWCACHE];
+static uint16	scclock;
+#endif
+
+/*
+ * A checksum of each 512-byte block of the last image read in from
+ * swap, so that swdisk() can write back only the blocks that
+ * have changed.  Block 0 is the one ending with udata; block k is
+ * at PROGBASE + 512 * (k - 1).
+ */
+#define NSWBLK	(1 + (((char *)(&udata + 1)) - PROGBASE) / 512)
+
+static uint32	swsum[65];	/* Room for 1 + 32K / 512. */
+static ptptr	swsumof;	/* Whose image they are of, or NULL. */
 
 extern int	(*disp_tab[])();
+#ifdef HOSTED
+extern void	idle(void);
+#endif
+#if defined(PROFIL) && !defined(HOSTED)
+extern char *	intpc;		/* From machdep.c. */
+extern void	prof_tick(char *);
+#endif
+#ifdef KTRACE
+extern uint32	kt_now(void);	/* From devmisc.c. */
+extern void	kt_record(void);
+#endif
 
 char *		stkptr;		/* Temp storage for swapout(). */
 int16		newid;		/* Temp storage for dofork(). */
 
+static int	swapdev[NSWAPDEV] = SWAPDEVS;
+static uint16	wblast;		/* wbclock at the last writeback(). */
+
 static int	j;		/* XXX - For unix()? */
 
 void
@@ -54,19 +133,25 @@ init2(void)
 	out(02, 0xf1);
 	ei();
 
+#ifdef HOSTED
+	rdtod();
+#else
 	/* Wait for an interrupted clock to set the time of day. */
 	while (!tod.t_date)
 		;
+#endif
 
 	/* Open the console tty device. */
 	if (d_open(TTYDEV) != 0)
 		panic("init2: no tty");
 
+#ifndef HOSTED	/* The host program has set ROOTDEV already. */
 	kprintf("boot: ");
 	udata.u_base = &bootchar;
 	udata.u_count = 1;
 	cdread(TTYDEV);
 	ROOTDEV = bootchar - '0';
+#endif
 
 	/* Mount the root device. */
 	if (fmount(ROOTDEV, NULLINODE))
@@ -78,6 +163,9 @@ init2(void)
 	i_ref(udata.u_cwd = root);
 	rdtime(&udata.u_time);
 
+#ifdef HOSTED
+	return;		/* The host program makes the system calls. */
+#endif
 	udata.u_argn2 = (int16)("/init");
 	udata.u_argn1 = (int16)(&arg[0]);
 	udata.u_argn = (int16)(&arg[1]);
@@ -146,10 +234,22 @@ getproc(void)
 {
 	int status;
 	static ptptr pp = ptab;	/* Pointer for round-robin scheduling. */
+#ifdef HOSTED
+	int n;
+
+	n = 0;
+#endif
 
 	for (;;) {
 		if (++pp >= ptab + PTABSIZE)
 		pp = ptab;
+#ifdef HOSTED
+		/* After a pass with nothing ready, wait for an interrupt. */
+		if (++n > PTABSIZE) {
+			n = 0;
+			idle();
+		}
+#endif
 
 		di();
 		status = pp->p_status;
@@ -187,6 +287,12 @@ swapout(void)
 		return (runticks = 0);
 	}
 
+	/* A process still READY is being preempted. */
+	if (udata.u_ptab->p_status == P_READY)
+		++udata.u_ru.ru_nivcsw;
+	else
+		++udata.u_ru.ru_nvcsw;
+
 	/* Save the stack pointer and critical registers. */
 #if 0	/* XXX - Comment out temorarily. */
 #asm
@@ -201,6 +307,13 @@ swapout(void)
 #endif
 	udata.u_sp = stkptr;
 
+#if NBANKS
+	/* A process in a bank, or that can be given one, stays there. */
+	if (ubank || bankmove())
+		bcopy(&udata, &ubsave[udata.u_ptab->p_bank - PBANK],
+		    sizeof(udata));
+	else
+#endif
 	swrite();
 	/* Read the new process in, and return into its context. */
 	swapin(newp);
@@ -210,29 +323,187 @@ swapout(void)
 }
 
 /*
- * swrite actually writes out the image.
+ * swrite puts the image away, in the swap cache if it has room.
  */
 static void
 swrite(void)
+{
+	++udata.u_ru.ru_nswapout;
+#if NSWCACHE
+	if (scput())
+		return;
+#endif
+	swdisk();
+}
+
+/*
+ * swdisk actually writes out the image.  If it was read in from
+ * swap, the blocks whose checksums are the same as then are
+ * still on the disk, and only the runs of changed blocks are
+ * written.
+ */
+static void
+swdisk(void)
 {
 	blkno_t blk;
+	unsigned int n;
+	char *p, *run;
+	int k, dev;
+
+	dev = udata.u_ptab->p_swdev;
 	blk = udata.u_ptab->p_swap;
+	n = (((char *)(&udata + 1)) - PROGBASE) & ~511;
 
-	/*
-	 * Start by writing out the user data.
-	 * The user data is written so that it
-	 * is packed to the top of one block.
-	 */
-	swapwrite(SWAPDEV, blk, 512, ((char *)(&udata + 1)) - 512);
+	/* exec() leaves its arguments in the pool. */
+	bforget(dev, blk, 1 + (n >> 9));
 
-	/*
-	 * The user address space is written in two i/o operations,
-	 * one from 0x100 to the break, and then from the stack up.
-	 * Notice that this might also include part or all of the
-	 * user data, but never anything above it.
-	 */
-	swapwrite(SWAPDEV, blk + 1,
-	    (((char *)(&udata + 1)) - PROGBASE) & ~511, PROGBASE);
+	if (swsumof != udata.u_ptab) {
+#if SWAPZ
+		if (swzwrite())
+			return;
+		udata.u_ptab->p_swz = 0;
+#endif
+		/*
+		 * Start by writing out the user data.
+		 * The user data is written so that it
+		 * is packed to the top of one block.
+		 */
+		swapwrite(dev, blk, 512, ((char *)(&udata + 1)) - 512);
+
+		/*
+		 * The user address space is written in two i/o
+		 * operations, one from 0x100 to the break, and then
+		 * from the stack up.  Notice that this might also
+		 * include part or all of the user data, but never
+		 * anything above it.
+		 */
+		swapwrite(dev, blk + 1, n, PROGBASE);
+		kstat.ks_swapout += 512 + n;
+		return;
+	}
+	swsumof = NULL;
+
+	p = ((char *)(&udata + 1)) - 512;
+	if (blksum(p) != swsum[0]) {
+		swapwrite(dev, blk, 512, p);
+		kstat.ks_swapout += 512;
+	} else
+		++kstat.ks_swsame;
+
+	run = NULL;
+	for (k = 1, p = PROGBASE; k < NSWBLK; ++k, p += 512) {
+		if (blksum(p) != swsum[k]) {
+			if (!run)
+				run = p;
+			continue;
+		}
+		++kstat.ks_swsame;
+		if (run) {
+			swapwrite(dev, blk + 1 + ((run - PROGBASE) >> 9),
+			    p - run, run);
+			kstat.ks_swapout += p - run;
+			run = NULL;
+		}
+	}
+	if (run) {
+		swapwrite(dev, blk + 1 + ((run - PROGBASE) >> 9),
+		    p - run, run);
+		kstat.ks_swapout += p - run;
+	}
+}
+
+#if SWAPZ
+/*
+ * swzwrite writes the image compressed by zpack(), the udata block
+ * and the rest as one stream from PROGBASE to the top of udata, in
+ * as many blocks from p_swap on as it takes.  If it would take as
+ * many as the image does as it is, it gives up and returns 0.
+ */
+static int
+swzwrite(void)
+{
+	char *p, *top;
+	unsigned int k, nblk;
+
+	top = (char *)(&udata + 1);
+	nblk = 1 + ((top - PROGBASE) >> 9);
+	p = PROGBASE;
+	for (k = 0; p < top; ++k) {
+		if (k + 1 >= nblk)
+			return (0);
+		zpack(&p, top, swzbuf, 512);
+		swapwrite(udata.u_ptab->p_swdev, udata.u_ptab->p_swap + k, 512,
+		    swzbuf);
+	}
+	udata.u_ptab->p_swz = k;
+	kstat.ks_swapout += k << 9;
+	++kstat.ks_swz;
+	return (1);
+}
+
+/*
+ * swzread reads in and unpacks the compressed image of p.  It is
+ * called from swapin() on the temporary stack, below PROGBASE or
+ * in the kernel's half, and so out of the way of the unpacking.
+ */
+static void
+swzread(ptptr p)
+{
+	char *q;
+	unsigned int k;
+
+	q = PROGBASE;
+	for (k = 0; k < p->p_swz; ++k) {
+		swapread(p->p_swdev, p->p_swap + k, 512, swzbuf);
+		q = zunpack(swzbuf, 512, q, (char *)(&udata + 1));
+	}
+	kstat.ks_swapin += k << 9;
+}
+#endif
+
+/*
+ * blksum is a checksum of the 512-byte block at p: a rotate-and-add
+ * of its words, which sees words that have moved, and the sum of
+ * that as it goes.  Sixteen bits alone would pass a changed block
+ * now and then, and lose it.
+ */
+static uint32
+blksum(char *p)
+{
+	uint16 *w;
+	uint16 a, b;
+
+	a = b = 0;
+	for (w = (uint16 *)p; w < (uint16 *)(p + 512); ++w) {
+		a = (a << 1 | a >> 15) + *w;
+		b += a;
+	}
+	return ((uint32)b << 16 | a);
+}
+
+/*
+ * swsums takes the checksums of the image just read in from swap.
+ */
+static void
+swsums(void)
+{
+	char *p;
+	int k;
+
+	swsum[0] = blksum(((char *)(&udata + 1)) - 512);
+	for (k = 1, p = PROGBASE; k < NSWBLK; ++k, p += 512)
+		swsum[k] = blksum(p);
+	swsumof = udata.u_ptab;
+}
+
+/*
+ * swstale is called when the running process's swap space has been
+ * written by other than swdisk(), so that it must be written whole.
+ */
+void
+swstale(void)
+{
+	swsumof = NULL;
 }
 
 /*
@@ -242,17 +513,49 @@ void
 swapin(ptptr pp)
 {
 	static blkno_t blk;
+	static int dev;
 	static ptptr newp;
 
 	di();
 	newp = pp;
+	dev = newp->p_swdev;
 	blk = newp->p_swap;
 	ei();
 
 	/* No auto variables can be used past here. */
 	tempstack();
+	swsumof = NULL;
+
+#if NBANKS
+	if (newp->p_bank) {
+		/* It is still in its bank; only its udata comes back. */
+		setbank(ubank = newp->p_bank);
+		bcopy(&ubsave[ubank - PBANK], &udata, sizeof(udata));
+		++kstat.ks_swtch;
+		goto resume;
+	}
 
-	swapread(SWAPDEV, blk, 512, ((char *)(&udata + 1)) - 512);
+	/* Give it a free bank if there is one, with bank 0's page zero. */
+	setbank(ubank = bankalloc(newp));
+	if (ubank)
+		bankcopy(0, ubank, (char *)0, 0x100);
+#endif
+#if NSWCACHE
+	if (scget(newp)) {
+		++kstat.ks_swtch;
+		++udata.u_ru.ru_nswapin;
+		goto resume;
+	}
+#endif
+#if SWAPZ
+	if (newp->p_swz) {
+		swzread(newp);
+		++kstat.ks_swtch;
+		++udata.u_ru.ru_nswapin;
+		goto resume;
+	}
+#endif
+	swapread(dev, blk, 512, ((char *)(&udata + 1)) - 512);
 
 	/*
 	 * The user address space is read in two i/o operations,
@@ -260,9 +563,17 @@ swapin(ptptr pp)
 	 * Notice that this might also include part or all of the
 	 * user data, but never anything above it.
 	 */
-	swapread(SWAPDEV, blk + 1,
+	swapread(dev, blk + 1,
 	    (((char *)(&udata + 1)) - PROGBASE) & ~511, PROGBASE);
-
+	kstat.ks_swapin += 512 +
+	    ((((char *)(&udata + 1)) - PROGBASE) & ~511);
+	swsums();
+	++kstat.ks_swtch;
+	++udata.u_ru.ru_nswapin;
+
+#if NBANKS || NSWCACHE || SWAPZ
+resume:
+#endif
 	if (newp != udata.u_ptab)
 		panic("swapin: mangled swapin");
 	di();
@@ -322,7 +633,25 @@ dofork(void)
 #endasm
 #endif
 	udata.u_sp = stkptr;
+#if NBANKS
+	/*
+	 * The child goes on in the bank in use, so the parent is copied
+	 * to a free bank, or written to swap if there is none.
+	 */
+	if (bankmove())
+		bcopy(&udata, &ubsave[udata.u_ptab->p_bank - PBANK],
+		    sizeof(udata));
+	else {
+		udata.u_ptab->p_bank = 0;
+		swrite();
+	}
+	if (ubank) {
+		p->p_bank = ubank;
+		bankp[ubank - PBANK] = p;
+	}
+#else
 	swrite();
+#endif
 #if 0	/* XXX - Comment out temorarily. */
 #asm
 	POP	HL	;Repair stack pointer.
@@ -351,19 +680,26 @@ newproc(ptptr p)
 
 	/* Note that ptab_alloc clears most of the entry. */
 	di();
-	/* Allow 65 blocks per process. */
-	p->p_swap = (p - ptab) * 65 + 1;
+	/*
+	 * Allow 65 blocks per process, the slots taking turns at the
+	 * swap devices, so that processes switched one after another
+	 * are on different ones.
+	 */
+	p->p_swdev = swapdev[(p - ptab) % NSWAPDEV];
+	p->p_swap = (p - ptab) / NSWAPDEV * 65 + 1;
 	p->p_status = P_RUNNING;
 	p->p_pptr = udata.u_ptab;
 	p->p_ignored = udata.u_ptab->p_ignored;
 	p->p_uid = udata.u_ptab->p_uid;
 	udata.u_ptab = p;
-	/* Clear tick counters. */
+	/* Clear tick counters and usage. */
 	bzero(&udata.u_utime, 4 * sizeof(time_t));
+	bzero(&udata.u_ru, 2 * sizeof(struct rusage));
 	ei();
 
 	rdtime(&udata.u_time);
-	i_ref(udata.u_cwd);
+	if (udata.u_cwd)	/* The first process has no cwd yet. */
+		i_ref(udata.u_cwd);
 	udata.u_cursig = udata.u_error = 0;
 
 	for (j = udata.u_files; j < udata.u_files + UFTSIZE; ++j)
@@ -404,6 +740,133 @@ nogood:
 	return (p);
 }
 
+#if NBANKS
+/*
+ * bankmove copies the running process to a free bank, which becomes
+ * its own.  It returns 0 if there is none.
+ */
+static int
+bankmove(void)
+{
+	int bank;
+
+	ifnot (bank = bankalloc(udata.u_ptab))
+		return (0);
+	bankcopy(ubank, bank, (char *)0, 0x8000);
+	return (bank);
+}
+
+/*
+ * bankalloc gives p a free bank, and returns it, or 0 if there is
+ * none.
+ */
+static int
+bankalloc(ptptr p)
+{
+	int j;
+
+	for (j = 0; j < NBANKS; ++j)
+		if (!bankp[j] || bankp[j]->p_bank != PBANK + j) {
+			bankp[j] = p;
+			return (p->p_bank = PBANK + j);
+		}
+	return (0);
+}
+
+#endif
+
+#if NBANKS || NSWCACHE
+/*
+ * bankcopy copies n bytes at addr in the user's half of memory from
+ * one bank to another, through the kernel's half.  n need not be a
+ * multiple of the bounce buffer's size.
+ */
+static void
+bankcopy(int from, int to, char *addr, unsigned int n)
+{
+	static char bounce[128];
+	unsigned int k;
+
+	for (; n; n -= k, addr += k) {
+		k = n < 128 ? n : 128;
+		frombank(from, addr, bounce, k);
+		tobank(to, bounce, addr, k);
+	}
+}
+#endif
+
+#if NSWCACHE
+/*
+ * scput copies the running process into a free entry of the swap
+ * cache.  It returns 0 if there is none.
+ */
+static int
+scput(void)
+{
+	struct swcache *sc;
+
+	for (sc = swcache; sc < swcache + NSWCACHE; ++sc)
+		ifnot (sc->sc_proc) {
+			bankcopy(ubank, SCBANK + (sc - swcache), PROGBASE,
+			    (char *)&udata - PROGBASE);
+			bcopy(&udata, &sc->sc_udata, sizeof(udata));
+			sc->sc_proc = udata.u_ptab;
+			sc->sc_when = ++scclock;
+			return (1);
+		}
+	return (0);
+}
+
+/*
+ * scget copies p in from the swap cache, if it is there, and frees
+ * its entry.  If it is not, it makes sure an entry is free for the
+ * next scput(), by writing out the least recently cached image.
+ * It is called from swapin(), when the user's half of memory and
+ * udata are free to be used.
+ */
+static int
+scget(ptptr p)
+{
+	struct swcache *sc;
+	struct swcache *lru;
+
+	lru = NULL;
+	for (sc = swcache; sc < swcache + NSWCACHE; ++sc) {
+		if (sc->sc_proc == p) {
+			bankcopy(SCBANK + (sc - swcache), ubank, PROGBASE,
+			    (char *)&udata - PROGBASE);
+			bcopy(&sc->sc_udata, &udata, sizeof(udata));
+			sc->sc_proc = NULL;
+			++kstat.ks_schit;
+			return (1);
+		}
+		/* A free entry, or else the one cached longest ago. */
+		if (!lru || !sc->sc_proc || (lru->sc_proc &&
+		    (uint16)(scclock - sc->sc_when) >
+		    (uint16)(scclock - lru->sc_when)))
+			lru = sc;
+	}
+	++kstat.ks_scmiss;
+	if (lru->sc_proc)
+		scflush(lru - swcache);
+	return (0);
+}
+
+/*
+ * scflush writes entry j of the swap cache out to its process's
+ * swap space, by way of the user's half of memory.
+ */
+static void
+scflush(int j)
+{
+	bankcopy(SCBANK + j, ubank, PROGBASE, (char *)&udata - PROGBASE);
+	bcopy(&swcache[j].sc_udata, &udata, sizeof(udata));
+	swcache[j].sc_proc = NULL;
+	++kstat.ks_scflush;
+	swdisk();
+}
+#endif
+
 /*
  * clk_int is the clock interrupt routine.  Its job is to increment
  * the clock counters, increment the tick count of the running
@@ -421,6 +884,10 @@ clk_int(void)
 	ifnot (in(0xf0))
 		return (0);
 
+#if defined(PROFIL) && !defined(HOSTED)	/* The host samples on SIGPROF. */
+	prof_tick(intpc);
+#endif
+
 	/* Increment processes and global tick counters. */
 	if (udata.u_ptab->p_status == P_RUNNING)
 		incrtick(udata.u_insys ? &udata.u_stime : &udata.u_utime);
@@ -431,6 +898,7 @@ clk_int(void)
 	if (++sec == TICKSPERSEC) {
 		sec = 0;	/* Update global time counters. */
 		rdtod();	/* Update time-of-day. */
+		++wbclock;
 
 		/* Update process alarm clocks. */
 		for (p = ptab; p < ptab + PTABSIZE; ++p)
@@ -439,6 +907,15 @@ clk_int(void)
 					sendsig(p, SIGALRM);
 	}
 
+	/* Write back old dirty blocks, if the kernel is not busy. */
+	if (wbclock != wblast && !udata.u_insys) {
+		udata.u_insys = 1;
+		inint = 0;
+		writeback();
+		di();
+		udata.u_insys = 0;
+	}
+
 	/* Check run time of current process. */
 	if (++runticks >= MAXTICKS && !udata.u_insys) {
 		/* Time to swap out. */
@@ -452,11 +929,35 @@ clk_int(void)
 	return (1);
 }
 
+/*
+ * writeback runs once a second of wbclock, from clk_int() when it
+ * interrupts the user or on the way out of a system call, where
+ * nothing in the kernel is half done.  Blocks dirty for WBAGE
+ * seconds are written back, and every WBMETA seconds the modified
+ * inodes and superblocks, which process exit no longer syncs.
+ */
+static void
+writeback(void)
+{
+	static uint16 lastmeta;
+	static int err;
+
+	err = udata.u_error;	/* Not to be blamed on a system call. */
+	wblast = wbclock;
+	if ((uint16)(wbclock - lastmeta) >= WBMETA) {
+		lastmeta = wbclock;
+		wrmeta();
+		bwriteback(1);
+	} else
+		bwriteback(0);
+	udata.u_error = err;
+}
+
 /*
  * No auto variables here, so carry flag will be preserved.
  */
 int
-unix(int16 argn3, int16 argn2, int16 argn1, int16 argn, char *uret, int callno)
+unix(int argn3, int argn2, int argn1, int argn, char *uret, int callno)
 {
 	udata.u_argn3 = argn3;
 	udata.u_argn2 = argn2;
@@ -467,6 +968,12 @@ unix(int16 argn3, int16 argn2, int16 argn1, int16 argn, char *uret, int callno)
 
 	udata.u_insys = 1;
 	udata.u_error = 0;
+	if ((unsigned char)callno < NSYSCALL)
+		++kstat.ks_sys[(unsigned char)callno];
+	++udata.u_ru.ru_nsyscall;
+#ifdef KTRACE
+	udata.u_ktstart = kt_now();
+#endif
 	ei();
 
 #ifdef DEBUG
@@ -477,12 +984,17 @@ unix(int16 argn3, int16 argn2, int16 argn1, int16 argn, char *uret, int callno)
 	/* Branch to correct routine. */
 	udata.u_retval = (*disp_tab[udata.u_callno])();
 
+#ifdef KTRACE
+	kt_record();
+#endif
 #ifdef DEBUG
 	kprintf("\t\t\t\t\t\tcall %d ret %x err %d\n",
 	    udata.u_callno, udata.u_retval, udata.u_error);
 #endif
 
 	chksigs();
+	if (wbclock != wblast)
+		writeback();
 	di();
 	if (runticks >= MAXTICKS) {
 		udata.u_ptab->p_status = P_READY;
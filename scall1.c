@@ -16,9 +16,12 @@ int		_unlink(char *);
 int		_read(int16, char *, uint16);
 int		_write(int16, char *, uint16);
 int16		_seek(int16, uint16, int16);
+int		_lseek(int16, uint32 *, int16);
 int		_chdir(char *);
 int		_mknod(char *, int16, int16);
 void		_sync(void);
+void		wrmeta(void);
+int		_fsync(int16);
 int		_access(char *, int16);
 int		_chmod(char *, int16);
 int		_chown(char *, int, int);
@@ -39,6 +42,7 @@ void		writei(inoptr);
 static inoptr	rwsetup(int);
 static int	min(int, int);
 static int	psize(inoptr);
+static uint16	rawrw(inoptr, int, int, uint16, int);
 static void	addoff(off_t *, int);
 static void	updoff(void);
 static void	stcpy(inoptr, char *);
@@ -86,6 +90,10 @@ _open(char *name, int16 flag)
 		goto cantopen;
 	}
 
+	if ((flag == O_WRONLY || flag == O_RDWR) && !isdevice(ino) &&
+	    rdonly(ino))
+		goto cantopen;
+
 	if (isdevice(ino) && d_open((int)ino->c_node.i_addr[0]) != 0) {
 		udata.u_error = ENXIO;
 		goto cantopen;
@@ -177,6 +185,10 @@ _creat(char *name, int16 mode)
 			udata.u_error = EACCES;
 			goto nogood;
 		}
+		if (!isdevice(ino) && rdonly(ino)) {
+			i_deref(ino);
+			goto nogood;
+		}
 		if (getmode(ino) == F_REG) {
 			/* Truncate the file to zero length. */
 			f_trunc(ino);
@@ -187,7 +199,8 @@ _creat(char *name, int16 mode)
 					    of_tab[j].o_ptr.o_offset = 0;
 		}
 	} else {
-		if (parent && (ino = newfile(parent, name))) {
+		if (parent && !rdonly(parent) &&
+		    (ino = newfile(parent, name))) {
 			/* Parent was dereferenced in newfile. */
 			ino->c_node.i_mode =
 			    (F_REG | (mode & MODE_MASK & ~udata.u_mask));
@@ -313,6 +326,11 @@ _link(char *name1, char *name2)
 		goto nogood;
 	}
 
+	if (rdonly(parent2)) {
+		i_deref(parent2);
+		goto nogood;
+	}
+
 	if (ch_link(parent2, "", filename(name2), ino) == 0)
 		goto nogood;
 
@@ -355,6 +373,9 @@ _unlink(char *path)
 		goto nogood;
 	}
 
+	if (rdonly(pino))
+		goto nogood;
+
 	/* Remove the directory entry. */
 	if (ch_link(pino, filename(path), "", NULLINODE) == 0)
 		goto nogood;
@@ -452,10 +473,13 @@ readi(inoptr ino)
 {
 	uint16 amount;
 	uint16 toread;
+	uint16 boff;
 	blkno_t pblk;
 	char *bp;
 	int dev;
+	int sh;
 	int ispipe;
+	int raw;
 	char *bread();
 	char *zerobuf();
 	blkno_t bmap();
@@ -486,17 +510,26 @@ readi(inoptr ino)
 		toread = udata.u_count;
 		dev = *(ino->c_node.i_addr);
 loop:
+		/* Offsets count 512-byte blocks; the device may use larger. */
+		sh = bshift(dev) - 9;
+		raw = !ispipe && getmode(ino) != F_DIR && mountable(dev);
 		while (toread) {
-			if ((pblk = bmap(ino, udata.u_offset.o_blkno, 1)) !=
-			    NULLBLK)
-				bp = bread(dev, pblk, 0);
-			else
-				bp = zerobuf();
-
-			bcopy(bp + udata.u_offset.o_offset, udata.u_base,
-			    (amount = min(toread,
-			    512 - udata.u_offset.o_offset)));
-			brelse(bp);
+			boff = ((udata.u_offset.o_blkno & ((1 << sh) - 1)) << 9) +
+			    udata.u_offset.o_offset;
+			if (raw && boff == 0 &&
+			    (amount = rawrw(ino, dev, sh, toread, 0)) != 0)
+				;
+			else {
+				if ((pblk = bmap(ino, udata.u_offset.o_blkno >> sh,
+				    1)) != NULLBLK)
+					bp = bread(dev, pblk, 0);
+				else
+					bp = zerobuf();
+
+				bcopy(bp + boff, udata.u_base,
+				    (amount = min(toread, (512 << sh) - boff)));
+				brelse(bp);
+			}
 
 			udata.u_base += amount;
 			addoff(&udata.u_offset, amount);
@@ -507,6 +540,13 @@ loop:
 				addoff(&(ino->c_node.i_size), -amount);
 				wakeup(ino);
 			}
+
+			/* Read ahead if this read ends at the end of a block. */
+			if (raw && !toread && boff + amount == (512 << sh) &&
+			    (getmode(ino) == F_BDEV || udata.u_offset.o_blkno <
+			    ino->c_node.i_size.o_blkno) && (pblk = bmap(ino,
+			    udata.u_offset.o_blkno >> sh, 1)) != NULLBLK)
+				bahead(dev, pblk);
 		}
 		break;
 	case F_CDEV:
@@ -525,11 +565,14 @@ writei(inoptr ino)
 {
 	uint16 amount;
 	uint16 towrite;
+	uint16 boff;
 	char *bp;
 	int ispipe;
 	blkno_t pblk;
 	int created;	/* Set by bmap if newly allocated block used. */
 	int dev;
+	int sh;
+	int raw;
 	char *zerobuf();
 	char *bread();
 	blkno_t bmap();
@@ -559,21 +602,30 @@ writei(inoptr ino)
 		/* Sleep if empty pipe. */
 		goto loop;
 loop:
+		sh = bshift(dev) - 9;
+		raw = !ispipe && getmode(ino) != F_DIR && mountable(dev);
 		while (towrite) {
-			amount = min(towrite, 512 - udata.u_offset.o_offset);
-
-			if ((pblk = bmap(ino, udata.u_offset.o_blkno, 0)) ==
-			    NULLBLK)
-				break;	/* No space to make more blocks. */
-			/*
-			 * If we are writing an entire block,
-			 * we don't care about its previous contents.
-			 */
-			bp = bread(dev, pblk, (amount == 512));
-
-			bcopy(udata.u_base, bp + udata.u_offset.o_offset,
-			    amount);
-			bawrite(bp);
+			boff = ((udata.u_offset.o_blkno & ((1 << sh) - 1)) << 9) +
+			    udata.u_offset.o_offset;
+			if (raw && boff == 0 &&
+			    (amount = rawrw(ino, dev, sh, towrite, 1)) != 0)
+				;
+			else {
+				amount = min(towrite, (512 << sh) - boff);
+				if ((pblk = bmap(ino, udata.u_offset.o_blkno >> sh,
+				    0)) == NULLBLK)
+					break;	/* No space to make more blocks. */
+				/*
+				 * If we are writing an entire block,
+				 * we don't care about its previous contents.
+				 */
+				bp = bread(dev, pblk, (amount == (512 << sh)));
+
+				bcopy(udata.u_base, bp + boff, amount);
+
+				/* Start writing whole blocks right away. */
+				bfree(bp, raw && amount == (512 << sh) ? 3 : 1);
+			}
 
 			udata.u_base += amount;
 			addoff(&udata.u_offset, amount);
@@ -608,6 +660,52 @@ loop:
 	}
 }
 
+/*
+ * rawrw moves as many whole blocks of a transfer as lie in one
+ * run on the disk straight between the disk and the user, without
+ * copying them through the buffer pool.  It returns the number of
+ * bytes moved, or 0 if there are not two whole blocks in a row to
+ * move, in which case the caller goes through the pool.  Holes end
+ * a run being read.  Writing fills them, but past the run's first
+ * block only with blocks reserved to continue it, so that no block
+ * is left allocated and unzeroed that bdirect() is not given.
+ */
+static uint16
+rawrw(inoptr ino, int dev, int sh, uint16 count, int wr)
+{
+	blkno_t lbn;
+	blkno_t pblk;
+	blkno_t b;
+	uint16 n;
+	uint16 k;
+	int rwflg;
+	blkno_t bmap();
+	int data_next();
+
+	lbn = udata.u_offset.o_blkno >> sh;
+	if ((n = count >> (9 + sh)) < 2)
+		return (0);
+	pblk = NULLBLK;
+	for (k = 0; k < n; ++k) {
+		if ((b = bmap(ino, lbn + k, 1)) == NULLBLK) {
+			if (!wr || (k && !data_next(ino, lbn + k)))
+				break;
+			/* The first is zeroed unless the next will follow. */
+			rwflg = k || (bmap(ino, lbn + 1, 1) == NULLBLK &&
+			    data_next(ino, lbn) >= 2) ? 2 : 0;
+			if ((b = bmap(ino, lbn + k, rwflg)) == NULLBLK)
+				break;
+		}
+		if (k == 0)
+			pblk = b;
+		else if (b != pblk + k)
+			break;
+	}
+	if (k < 2 || bdirect(dev, pblk, k, wr))
+		return (0);
+	return (k << (9 + sh));
+}
+
 static int
 min(int a, int b)
 {
@@ -719,6 +817,62 @@ _seek(int16 file, uint16 offset, int16 flag)
 	return ((int16)retval);
 }
 
+/****************************************
+lseek(int16 file, uint32 *offset, int16 flag)
+*****************************************/
+/*
+ * The 32-bit byte offset is passed by reference, and the resulting
+ * file position is stored back through it.  The flag is as for the
+ * first three modes of seek().
+ */
+int
+_lseek(int16 file, uint32 *offset, int16 flag)
+{
+	file = (int16)udata.u_argn2;
+	offset = (uint32 *)udata.u_argn1;
+	flag = (int16)udata.u_argn;
+
+	inoptr ino;
+	off_t *op;
+	uint32 pos;
+	inoptr getinode();
+
+	if ((ino = getinode(file)) == NULLINODE)
+		return (-1);
+
+	if (getmode(ino) == F_PIPE) {
+		udata.u_error = ESPIPE;
+		return (-1);
+	}
+
+	ifnot (valadr((char *)offset, sizeof(uint32)))
+		return (-1);
+
+	op = &of_tab[udata.u_files[file]].o_ptr;
+
+	switch (flag) {
+	case 0:
+		pos = 0;
+		break;
+	case 1:
+		pos = (op->o_blkno << 9) + op->o_offset;
+		break;
+	case 2:
+		pos = (ino->c_node.i_size.o_blkno << 9) +
+		    ino->c_node.i_size.o_offset;
+		break;
+	default:
+		udata.u_error = EINVAL;
+		return (-1);
+	}
+
+	pos += (int32)*offset;
+	op->o_blkno = pos >> 9;
+	op->o_offset = pos & 511;
+	*offset = pos;
+	return (0);
+}
+
 /************************************
 chdir(char *dir)
 ************************************/
@@ -774,6 +928,9 @@ _mknod(char *name, int16 mode, int16 dev)
 		goto nogood3;
 	}
 
+	if (rdonly(parent))
+		goto nogood2;
+
 	ifnot (ino = newfile(parent, name))
 		goto nogood2;
 
@@ -798,11 +955,20 @@ sync(void)
 ***************************************/
 void
 _sync(void)
+{
+	wrmeta();
+	bufsync();	/* Clear buffer pool. */
+}
+
+/*
+ * wrmeta writes out the modified inodes and superblocks, for sync()
+ * and the writeback timer.
+ */
+void
+wrmeta(void)
 {
 	int j;
 	inoptr ino;
-	char *buf;
-	char *bread();
 
 	/* Write out modified inodes. */
 	for (ino = i_tab; ino < i_tab + ITABSIZE; ++ino) {
@@ -813,17 +979,32 @@ _sync(void)
 	}
 
 	/* Write out modified super blocks. */
-	/* This fills the rest of the super block with garbage. */
 	for (j = 0; j < NDEVS; ++j) {
-		if (fs_tab[j].s_mounted == SMOUNTED && fs_tab[j].s_fmod) {
+		if (fs_tab[j].s_mounted == SMOUNTED && fs_tab[j].s_fmod &&
+		    !(fs_tab[j].s_flags & MNT_RDONLY)) {
 			fs_tab[j].s_fmod = 0;
-			buf = bread(j, 1, 1);
-			bcopy((char *)&fs_tab[j], buf, 512);
-			bfree(buf, 2);
+			wr_super(fsdev(j));
 		}
 	}
+}
 
-	bufsync();	/* Clear buffer pool. */
+/****************************************
+fsync(int16 fd)
+****************************************/
+int
+_fsync(int16 fd)
+{
+	fd = (int16)udata.u_argn;
+
+	inoptr ino;
+	inoptr getinode();
+
+	if ((ino = getinode(fd)) == NULLINODE)
+		return (-1);
+	if (fsof(ino->c_dev)->s_flags & MNT_RDONLY)
+		return (0);
+	f_sync(ino);
+	return (udata.u_error ? -1 : 0);
 }
 
 /****************************************
@@ -892,6 +1073,11 @@ _chmod(char *path, int16 mode)
 		return (-1);
 	}
 
+	if (rdonly(ino)) {
+		i_deref(ino);
+		return (-1);
+	}
+
 	ino->c_node.i_mode = (mode & MODE_MASK) | (ino->c_node.i_mode & F_MASK);
 	setftime(ino, C_TIME);
 	i_deref(ino);
@@ -920,6 +1106,11 @@ _chown(char *path, int owner, int group)
 		return (-1);
 	}
 
+	if (rdonly(ino)) {
+		i_deref(ino);
+		return (-1);
+	}
+
 	ino->c_node.i_uid = owner;
 	ino->c_node.i_gid = group;
 	setftime(ino, C_TIME);
@@ -974,10 +1165,26 @@ _fstat(int16 fd, char *buf)
 static void
 stcpy(inoptr ino, char *buf)
 {
-	/* XXX - Violently system-dependent. */
-	bcopy((char *)&(ino->c_dev), buf, 12);
-	bcopy((char *)&(ino->c_node.i_addr[0]), buf + 12, 2);
-	bcopy((char *)&(ino->c_node.i_size), buf + 14, 16);
+	struct stat *st;
+
+	st = (struct stat *)buf;
+	st->st_dev = ino->c_dev;
+	st->st_ino = ino->c_num;
+	st->st_mode = ino->c_node.i_mode;
+	st->st_nlink = ino->c_node.i_nlink;
+	st->st_uid = ino->c_node.i_uid;
+	st->st_gid = ino->c_node.i_gid;
+	st->st_rdev = ino->c_node.i_addr[0];
+	if (ino->c_node.i_size.o_blkno > 0xffff) {
+		st->st_size.o_blkno = 0xffff;
+		st->st_size.o_offset = 511;
+	} else {
+		st->st_size.o_blkno = ino->c_node.i_size.o_blkno;
+		st->st_size.o_offset = ino->c_node.i_size.o_offset;
+	}
+	st->st_atime = ino->c_node.i_atime;
+	st->st_mtime = ino->c_node.i_mtime;
+	st->st_ctime = ino->c_node.i_ctime;
 }
 
 /************************************
@@ -1061,12 +1268,14 @@ _getfsys(int16 dev, struct filesys *buf)
 	dev = (int16)udata.u_argn1;
 	buf = (struct filesys *)udata.u_argn;
 
-	if (dev < 0 || dev >= NDEVS || fs_tab[dev].s_mounted != SMOUNTED) {
+	fsptr fp;
+
+	if (!(fp = fsof(dev)) || fp->s_mounted != SMOUNTED) {
 		udata.u_error = ENXIO;
 		return (-1);
 	}
 
-	bcopy((char *)&fs_tab[dev], (char *)buf, sizeof(struct filesys));
+	bcopy((char *)fp, (char *)buf, sizeof(struct filesys));
 	return (0);
 }
 
@@ -1104,10 +1313,13 @@ _ioctl(int fd, int request, char *data)
 	return (0);
 }
 
-/* XXX - This implementation of mount ignores the rwflag. */
 /*****************************************
 mount(char *spec, char *dir, int rwflag)
 *******************************************/
+/*
+ * rwflag is MNT_RDONLY, MNT_NOATIME, or both.  A read-only
+ * filesystem is never written, not even its superblock.
+ */
 int
 _mount(char *spec, char *dir, int rwflag)
 {
@@ -1117,6 +1329,7 @@ _mount(char *spec, char *dir, int rwflag)
 
 	inoptr sino, dino;
 	int dev;
+	fsptr fp;
 	inoptr n_open();
 
 	ifnot (super()) {
@@ -1144,12 +1357,12 @@ _mount(char *spec, char *dir, int rwflag)
 
 	dev = (int)sino->c_node.i_addr[0];
 
-	if ( dev >= NDEVS || d_open(dev)) {
+	if (!(fp = fsof(dev)) || d_open(dev)) {
 		udata.u_error = ENXIO;
 		goto nogood;
 	}
 
-	if (fs_tab[dev].s_mounted || dino->c_refs != 1 ||
+	if (fp->s_mounted || dino->c_refs != 1 ||
 	    dino->c_num == ROOTINODE) {
 		udata.u_error = EBUSY;
 		goto nogood;
@@ -1161,6 +1374,9 @@ _mount(char *spec, char *dir, int rwflag)
 		udata.u_error = EBUSY;
 		goto nogood;
 	}
+	fp->s_flags = rwflag & (MNT_RDONLY | MNT_NOATIME);
+	if (rwflag & MNT_RDONLY)
+		fp->s_fmod = 0;
 
 	i_deref(dino);
 	i_deref(sino);
@@ -1181,6 +1397,7 @@ _umount(char *spec)
 
 	inoptr sino;
 	int dev;
+	fsptr fp;
 	inoptr ptr;
 	inoptr n_open();
 
@@ -1203,7 +1420,7 @@ _umount(char *spec)
 		goto nogood;
 	}
 
-	if (!fs_tab[dev].s_mounted) {
+	if (!(fp = fsof(dev)) || !fp->s_mounted) {
 		udata.u_error = EINVAL;
 		goto nogood;
 	}
@@ -1215,9 +1432,14 @@ _umount(char *spec)
 		}
 	}
 
-	_sync();
-	fs_tab[dev].s_mounted = 0;
-	i_deref(fs_tab[dev].s_mntpt);
+	/* Only this device's blocks need to go out. */
+	if (fp->s_fmod && !(fp->s_flags & MNT_RDONLY)) {
+		fp->s_fmod = 0;
+		wr_super(dev);
+	}
+	fp->s_mounted = 0;
+	bufinval(dev);
+	i_deref(fp->s_mntpt);
 
 	i_deref(sino);
 	return (0);
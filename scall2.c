@@ -27,12 +27,16 @@ int		_pause(void);
 int		_signal(int16, int16 (*func)());
 int		_kill(int16, int16);
 int		_alarm(uint16);
+int		_profil(int, char *, int);
+int		_getrusage(int, struct rusage *);
+void		prof_tick(char *);
 
 void		doexit(int16, int16);
 
 static void	exec2(void);
 static int	wargs(char **, int);
 static char *	rargs(char *, int, int *);
+static void	ruadd(struct rusage *, struct rusage *);
 
 
 /* getpid() */
@@ -238,16 +242,22 @@ exec2(void)
 	char *progptr;
 	char *buf;
 	blkno_t pblk;
+	int sh;
 	blkno_t bmap();
 	char *bread();
 
-	/* Read in the rest of the program. */
+	/*
+	 * Read in the rest of the program, 512 bytes at a time.
+	 * Filesystem blocks may be larger; if so, the same block
+	 * is found again in the buffer pool for each piece.
+	 */
+	sh = fsof(udata.u_ino->c_dev)->s_bshift - 9;
 	progptr = PROGBASE + 512;
 	for (blk = 1; blk <= udata.u_ino->c_node.i_size.o_blkno; ++blk) {
-		pblk = bmap(udata.u_ino, blk, 1);
-		if (pblk != -1) {
+		pblk = bmap(udata.u_ino, blk >> sh, 1);
+		if (pblk != NULLBLK) {
 			buf = bread( udata.u_ino->c_dev, pblk, 0);
-			bcopy(buf, progptr, 512);
+			bcopy(buf + ((blk & ((1 << sh) - 1)) << 9), progptr, 512);
 			bfree(buf, 0);
 		}
 		progptr += 512;
@@ -291,8 +301,9 @@ wargs(char **argv, int blk)
 	char *bread();
 
 	/* Gather the arguments and put them on the swap device. */
-	argbuf = (struct s_argblk *)bread(SWAPDEV,
+	argbuf = (struct s_argblk *)bread(udata.u_ptab->p_swdev,
 	    udata.u_ptab->p_swap + blk, 2);
+	swstale();	/* The swap space no longer holds the image. */
 
 	bufp = argbuf->a_buf;
 	for (j = 0; argv[j] != NULL; ++j) {
@@ -325,7 +336,7 @@ rargs(char *ptr, int blk, int *cnt)
 	char *bread();
 
 	/* Read back the arguments. */
-	argbuf = (struct s_argblk *)bread(SWAPDEV,
+	argbuf = (struct s_argblk *)bread(udata.u_ptab->p_swdev,
 	    udata.u_ptab->p_swap + blk, 0);
 
 	/* Move them into the users address space, at the very top. */
@@ -436,6 +447,7 @@ ok:
 				addtick(&udata.u_cutime, &(p->p_wait));
 				addtick(&udata.u_cstime,
 				    (char *)(&(p->p_wait)) + sizeof(time_t));
+				ruadd(&udata.u_cru, &p->p_ru);
 				ei();
 				return (retval);
 			}
@@ -466,8 +478,6 @@ doexit(int16 val, int16 val2)
 		ifnot (udata.u_files[j] & 0x80)	/* Portable equiv. of == -1. */
 			doclose(j);
 
-	_sync();	/* Not necessary, but a good idea. */
-
 	di();
 	udata.u_ptab->p_exitval = (val << 8) | (val2 & 0xff);
 
@@ -484,11 +494,16 @@ doexit(int16 val, int16 val2)
 	addtick(&udata.u_utime, &udata.u_cutime);
 	addtick(&udata.u_stime, &udata.u_cstime);
 	bcopy(&udata.u_utime, &(udata.u_ptab->p_wait), 2 * sizeof(time_t));
+	ruadd(&udata.u_ru, &udata.u_cru);
+	bcopy(&udata.u_ru, &(udata.u_ptab->p_ru), sizeof(struct rusage));
 
 	/* Wake up a waiting parent, if any. */
 	if (udata.u_ptab != initproc)
 		wakeup((char *)udata.u_ptab->p_pptr);
 	udata.u_ptab->p_status = P_ZOMBIE;
+#if NBANKS
+	udata.u_ptab->p_bank = 0;	/* Its bank is free. */
+#endif
 	ei();
 	swapin(getproc());
 	panic("doexit:won't exit");
@@ -585,3 +600,114 @@ _alarm(uint16 secs)
 	ei();
 	return (retval);
 }
+
+#ifdef PROFIL
+static struct kprof kprof;
+static char profon;
+
+/*
+ * prof_tick counts a clock tick in the kernel profile.  pc is where
+ * the clock interrupted.
+ */
+void
+prof_tick(char *pc)
+{
+	unsigned int n;
+
+	ifnot (profon)
+		return;
+	ifnot (udata.u_insys) {
+		++kprof.pr_user;
+		return;
+	}
+	n = (unsigned int)(pc - kprof.pr_base) >> kprof.pr_shift;
+	if (pc < kprof.pr_base || n >= NPROF)
+		++kprof.pr_out;
+	else if (kprof.pr_hist[n] != 0xffff)
+		++kprof.pr_hist[n];
+}
+#endif
+
+/*********************************
+profil(int cmd, char *arg, int n)
+*********************************/
+int
+_profil(int cmd, char *arg, int n)
+{
+	cmd = (int)udata.u_argn2;
+	arg = (char *)udata.u_argn1;
+	n = (int)udata.u_argn;
+
+#ifdef PROFIL
+	switch (cmd) {
+	case PROF_START:
+		ifnot (super()) {
+			udata.u_error = EPERM;
+			return (-1);
+		}
+		if (n < 0 || n > 15) {	/* It is a shift of a 16-bit pc. */
+			udata.u_error = EINVAL;
+			return (-1);
+		}
+		di();
+		bzero(&kprof, sizeof(kprof));
+		kprof.pr_base = arg;
+		kprof.pr_shift = n;
+		profon = 1;
+		ei();
+		return (0);
+	case PROF_STOP:
+		profon = 0;
+		return (0);
+	case PROF_READ:
+		if (n > sizeof(kprof))
+			n = sizeof(kprof);
+		ifnot (valadr(arg, n))
+			return (-1);
+		di();
+		bcopy(&kprof, arg, n);
+		ei();
+		return (n);
+	}
+#endif
+	udata.u_error = EINVAL;
+	return (-1);
+}
+
+/*********************************************
+getrusage(int who, struct rusage *ru)
+*********************************************/
+int
+_getrusage(int who, struct rusage *ru)
+{
+	who = (int)udata.u_argn1;
+	ru = (struct rusage *)udata.u_argn;
+
+	ifnot (valadr((char *)ru, sizeof(struct rusage)))
+		return (-1);
+
+	if (who == RUSAGE_SELF)
+		bcopy(&udata.u_ru, ru, sizeof(struct rusage));
+	else if (who == RUSAGE_CHILDREN)
+		bcopy(&udata.u_cru, ru, sizeof(struct rusage));
+	else {
+		udata.u_error = EINVAL;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * ruadd adds the usage in r2 to r1.
+ */
+static void
+ruadd(struct rusage *r1, struct rusage *r2)
+{
+	r1->ru_inblock += r2->ru_inblock;
+	r1->ru_oublock += r2->ru_oublock;
+	r1->ru_nswapin += r2->ru_nswapin;
+	r1->ru_nswapout += r2->ru_nswapout;
+	r1->ru_nvcsw += r2->ru_nvcsw;
+	r1->ru_nivcsw += r2->ru_nivcsw;
+	r1->ru_nsyscall += r2->ru_nsyscall;
+}
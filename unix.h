@@ -2,7 +2,7 @@
 UZI (Unix Z80 Implementation) Kernel:  unix.h
 ***************************************************/
 
-#ifndef vax
+#ifndef HOSTED
 #define CPM
 #endif
 
@@ -10,6 +10,17 @@ UZI (Unix Z80 Implementation) Kernel:  unix.h
 #define OFTSIZE		15	/* Open file table size. */
 #define ITABSIZE	20	/* Inode table size. */
 #define PTABSIZE	20	/* Process table size. */
+#ifndef MAXBSIZE
+/*
+ * The largest fs block size that can be mounted: 512, 1024, 2048 or
+ * 4096.  Each of the NBUFS buffers is this big, so every doubling
+ * costs NBUFS * MAXBSIZE more bytes.  The hosted build uses 4096.
+ */
+#define MAXBSIZE	1024
+#endif
+#ifndef NPROF
+#define NPROF		256	/* Buckets in the kernel profile, with PROFIL. */
+#endif
 
 #define NSIGS		16	/* Number of signals <= 16. */
 
@@ -18,13 +29,14 @@ UZI (Unix Z80 Implementation) Kernel:  unix.h
 #define TICKSPERSEC	10	/* Ticks per second. */
 #define MAXTICKS	10	/* Max ticks before swap out (time slice). */
 
-#define ARGBLK		0	/* Block num on SWAPDEV for arguments. */
+#define ARGBLK		0	/* Block num in swap space for arguments. */
 #define PROGBASE	((char *)(0x100))
 #define MAXEXEC		0	/* Max num of blocks of executable file. */
 
 #define EMAGIC		0xc3	/* Header of executable. */
 #define CMAGIC		24721	/* Random num for cinode c_magic. */
 #define SMOUNTED	12742	/* Magic num to specify mounted filesystem. */
+#define SMOUNT32	12743	/* Same, on disk, for a 32-bit filesystem. */
 #define NULL		((void *)0)
 
 /* XXX - Macros to trick the compiler into generating more compact code. */
@@ -35,9 +47,13 @@ UZI (Unix Z80 Implementation) Kernel:  unix.h
 #ifdef CPM
 	typedef	unsigned uint16;
 	typedef	int int16;
+	typedef	unsigned long uint32;
+	typedef	long int32;
 #else
 	typedef	unsigned short uint16;
 	typedef	short int16;
+	typedef	unsigned int uint32;
+	typedef	int int32;
 #endif
 
 typedef struct s_queue {
@@ -68,22 +84,29 @@ struct tms {
 #define M_TIME		2
 #define C_TIME		4
 
+/* Flags for mount(), kept in s_flags. */
+#define MNT_RDONLY	1	/* No writes, and nothing written back. */
+#define MNT_NOATIME	2	/* Reads leave the access time alone. */
+
+typedef	uint32 blkno_t;		/* Block numbers are 32 bits in core. */
+#define NULLBLK		((blkno_t) - 1)
+
 typedef struct off_t {
-	uint16	o_blkno;	/* Block number. */
+	blkno_t	o_blkno;	/* Block number. */
 	int16	o_offset;	/* Offset within block 0 - 511. */
 } off_t;
 
-typedef	uint16 blkno_t;		/* Can have 65536 512-byte blocks in filesystem. */
-#define NULLBLK		((blkno_t) - 1)
-
 typedef struct blkbuf {
-	char	bf_data[512];	/* XXX - This MUST be first! */
+	char	bf_data[MAXBSIZE]; /* XXX - This MUST be first! */
 	char	bf_dev;
+	char	bf_shift;	/* Log2 of the block size. */
 	blkno_t	bf_blk;
 	char	bf_dirty;
-	char	bf_busy;
+	char	bf_busy;	/* 1 if in use, 2 if the disk has it. */
+	char	bf_error;	/* A write the disk queue did failed. */
 	uint16	bf_time;	/* LRU time stamp. */
-	struct	blkbuf *bf_next; /* LRU free list pointer. */
+	uint16	bf_dtime;	/* wbclock when it was made dirty. */
+	struct	blkbuf *bf_next; /* Disk request queue link. */
 } blkbuf, *bufptr;
 
 typedef struct dinode {
@@ -96,7 +119,46 @@ typedef struct dinode {
 	time_t	i_mtime;
 	time_t	i_ctime;
 	blkno_t	i_addr[20];
-} dinode;			/* XXX - Exactly 64 bytes long! */
+} dinode;			/* In-core form of an inode. */
+
+/* On-disk inode of a V7-format filesystem. */
+typedef struct d7inode {
+	uint16	i_mode;
+	uint16	i_nlink;
+	uint16	i_uid;
+	uint16	i_gid;
+	uint16	i_sizeblk;
+	int16	i_sizeoff;
+	time_t	i_atime;
+	time_t	i_mtime;
+	time_t	i_ctime;
+	uint16	i_addr[20];
+} d7inode;			/* XXX - Exactly 64 bytes long! */
+
+/* On-disk inode of a 32-bit filesystem. */
+typedef struct d32inode {
+	uint16	i_mode;
+	uint16	i_nlink;
+	uint16	i_uid;
+	uint16	i_gid;
+	uint32	i_sizeblk;
+	int16	i_sizeoff;
+	uint16	i_pad;
+	time_t	i_atime;
+	time_t	i_mtime;
+	time_t	i_ctime;
+	uint32	i_addr[20];
+	char	i_spare[20];
+} d32inode;			/* XXX - Exactly 128 bytes long! */
+
+/*
+ * A size as user programs see it in struct stat, which keeps its old
+ * layout: 16 bits of block number.  Sizes past it read as the largest.
+ */
+typedef struct soff_t {
+	uint16	o_blkno;
+	int16	o_offset;
+} soff_t;
 
 /* Really only used by users. */
 struct stat {
@@ -107,7 +169,7 @@ struct stat {
 	uint16	st_uid;
 	uint16	st_gid;
 	uint16	st_rdev;
-	off_t	st_size;
+	soff_t	st_size;
 	time_t	st_atime;
 	time_t	st_mtime;
 	time_t	st_ctime;
@@ -145,6 +207,11 @@ typedef struct cinode {
 	dinode	c_node;
 	char	c_refs;		/* In-core reference count. */
 	char	c_dirty;	/* Modified flag. */
+	blkno_t	c_elblk;	/* Extent cache: first logical block, */
+	blkno_t	c_epblk;	/* the physical block it maps to, */
+	uint16	c_elen;		/* and the length of the contiguous run. */
+	blkno_t	c_pablk;	/* Next block reserved for appending, */
+	char	c_palen;	/* and how many are reserved. */
 } cinode, *inoptr;
 
 #define NULLINODE	((inoptr)NULL)
@@ -155,10 +222,14 @@ typedef struct direct {
 	char	d_name[14];
 } direct;
 
+/* Filesystem formats, kept in s_fstype. */
+#define FS_V7		0	/* 16-bit block numbers, 64-byte inodes. */
+#define FS_32		1	/* 32-bit block numbers, 128-byte inodes. */
+
 typedef struct filesys {
 	int16	s_mounted;
 	uint16	s_isize;
-	uint16	s_fsize;
+	blkno_t	s_fsize;
 	int16	s_nfree;
 	blkno_t	s_free[50];
 	int16	s_ninode;
@@ -167,9 +238,59 @@ typedef struct filesys {
 	time_t	s_time;
 	blkno_t	s_tfree;
 	uint16	s_tinode;
+	/* The rest is in-core only, and is set up by fmount(). */
+	char	s_fstype;	/* FS_V7 or FS_32. */
+	char	s_inoshift;	/* Log2 of inodes per block. */
+	char	s_indshift;	/* Log2 of entries per indirect block. */
+	char	s_nlevels;	/* Levels of indirection in i_addr[]. */
+	char	s_bshift;	/* Log2 of the block size. */
+	char	s_ifirst;	/* First block of inodes. */
+	char	s_flags;	/* MNT_RDONLY, MNT_NOATIME. */
 	inoptr	s_mntpt;	/* Mount point. */
 } filesys, *fsptr;
 
+/*
+ * fs_tab has an entry for each device that can be mounted: devices
+ * 0..NDEVS-2, and the RAM disk in the last.  mountable() says whether
+ * a device has one, fsof() finds it, or NULL if there is none, and
+ * fsdev() is the device of entry j.
+ */
+#define mountable(dev)	(((dev) >= 0 && (dev) < NDEVS - 1) || (dev) == RDDEV)
+#define fsof(dev)	((dev) >= 0 && (dev) < NDEVS - 1 ? fs_tab + (dev) : \
+			    (dev) == RDDEV ? fs_tab + NDEVS - 1 : (fsptr)NULL)
+#define fsdev(j)	((j) == NDEVS - 1 ? RDDEV : (j))
+
+/* On-disk superblock of a V7-format filesystem. */
+typedef struct d7super {
+	int16	s_mounted;	/* SMOUNTED */
+	uint16	s_isize;
+	uint16	s_fsize;
+	int16	s_nfree;
+	uint16	s_free[50];
+	int16	s_ninode;
+	uint16	s_inode[50];
+	int16	s_fmod;
+	time_t	s_time;
+	uint16	s_tfree;
+	uint16	s_tinode;
+} d7super;
+
+/* On-disk superblock of a 32-bit filesystem. */
+typedef struct d32super {
+	int16	s_mounted;	/* SMOUNT32 */
+	uint16	s_isize;
+	uint32	s_fsize;
+	int16	s_nfree;
+	int16	s_ninode;
+	uint32	s_free[50];
+	uint16	s_inode[50];
+	int16	s_fmod;
+	uint16	s_tinode;
+	time_t	s_time;
+	uint32	s_tfree;
+	uint16	s_bshift;	/* Log2 of the block size; 0 means 9. */
+} d32super;
+
 typedef struct oft {
 	off_t	o_ptr;		/* File position pointer. */
 	inoptr	o_inode;	/* Pointer into in-core inode table. */
@@ -209,6 +330,32 @@ typedef struct oft {
 
 #define sigmask(sig)	(1 << (sig))
 
+/* A system call, as traced into the ring read from /dev/ktrace. */
+struct ktrec {
+	uint16	kt_seq;		/* Counts up; a gap means records were lost. */
+	char	kt_callno;
+	char	kt_error;	/* u_error on return. */
+	int	kt_pid;
+	int	kt_arg[4];	/* u_argn3, u_argn2, u_argn1 and u_argn. */
+	int	kt_retval;
+	uint32	kt_start;	/* Clock ticks at the call, */
+	uint32	kt_end;		/* and at its return. */
+};
+
+/* Resource usage, for getrusage(). */
+struct rusage {
+	uint32	ru_inblock;	/* Buffer blocks read. */
+	uint32	ru_oublock;	/* Buffer blocks written. */
+	uint32	ru_nswapin;	/* Times swapped in. */
+	uint32	ru_nswapout;	/* Times swapped out. */
+	uint32	ru_nvcsw;	/* Gave up the CPU to wait. */
+	uint32	ru_nivcsw;	/* Had the CPU taken away. */
+	uint32	ru_nsyscall;	/* System calls made. */
+};
+
+#define RUSAGE_SELF	0
+#define RUSAGE_CHILDREN	(-1)
+
 /* Process table entry. */
 typedef struct p_tab {
 	char	p_status;	/* Process status. */
@@ -218,11 +365,15 @@ typedef struct p_tab {
 	blkno_t	p_swap;		/* Starting block of swap space. */
 	unsigned p_alarm;	/* Seconds until alarm goes off. */
 	unsigned p_exitval;	/* Exit value. */
+	char	p_bank;		/* Bank it is kept in, or 0 if swapped. */
+	char	p_swdev;	/* Device it swaps to. */
+	char	p_swz;		/* Blocks of its compressed swap image, or 0. */
 	/* Everything below here is overlaid by time info at exit. */
 	char	*p_wait;	/* Address of thing waited for. */
 	int	p_priority;	/* Process priority. */
 	uint16	p_pending;	/* Pending signals. */
 	uint16	p_ignored;	/* Ignored signals. */
+	struct	rusage p_ru;	/* Usage of a zombie and its children. */
 } p_tab, *ptptr;
 
 /* Per-process data (swapped with process). */
@@ -277,6 +428,9 @@ typedef struct u_data {
 	time_t	u_stime;	/* Ticks in system mode. */
 	time_t	u_cutime;	/* Total childrens ticks. */
 	time_t	u_cstime;
+	struct	rusage u_ru;	/* Resource usage. */
+	struct	rusage u_cru;	/* Total of waited-for children's. */
+	uint32	u_ktstart;	/* Tick the current call began, for KTRACE. */
 } u_data;
 
 /* Struct to temporarily hold arguments in execve. */
@@ -295,8 +449,60 @@ typedef struct devsw {
 	int	(*dev_read)();	/* Offset would be ignored for block devices. */
 	int	(*dev_write)();	/* blkno and offset ignored for tty, etc. */
 	int	(*dev_ioctl)();	/* Count is rounded to 512 for block devices. */
+	int	(*dev_start)();	/* start(minor,bufptr): transfer, don't wait. */
 } devsw;
 
+/* The ioctl bufsync() makes of drivers that keep blocks of their own. */
+#define DIOSYNC		1
+
+/* Floppy ioctls; data is two chars, the interleave and the skew. */
+#define FDGETIL		2
+#define FDSETIL		3
+
+/*
+ * Kernel statistics, read through /dev/kstat.  The counters only
+ * ever go up; take the difference of two snapshots.
+ */
+#define NSYSCALL	47	/* Entries in disp_tab[]. */
+
+struct kstat {
+	uint32	ks_bhit;	/* bread() found the block in the pool. */
+	uint32	ks_bmiss;	/* bread() had to take a buffer. */
+	uint32	ks_bdirty;	/* Dirty buffers written out to reuse them. */
+	uint32	ks_ihit;	/* i_open() found the inode in i_tab[]. */
+	uint32	ks_imiss;	/* i_open() read the inode in. */
+	uint32	ks_swapin;	/* Bytes swapped in. */
+	uint32	ks_swapout;	/* Bytes swapped out. */
+	uint32	ks_swtch;	/* Context switches. */
+	uint32	ks_dcmd;	/* Disk commands issued. */
+	uint32	ks_fdtrk;	/* Floppy tracks read or written. */
+	uint32	ks_fdrot;	/* Floppy revolutions they took. */
+	uint32	ks_schit;	/* Swap-ins found in the swap cache, */
+	uint32	ks_scmiss;	/* and read from swap. */
+	uint32	ks_scflush;	/* Cached images written out to make room. */
+	uint32	ks_swsame;	/* Blocks not swapped out, being unchanged. */
+	uint32	ks_swz;		/* Images swapped out compressed. */
+	uint32	ks_sys[NSYSCALL]; /* System calls, by number. */
+};
+
+/*
+ * The kernel profile, kept by clk_int() when the kernel is built
+ * with PROFIL.  Each tick in the kernel counts in the bucket for
+ * the interrupted PC.
+ */
+struct kprof {
+	char	*pr_base;	/* Lowest address in the histogram. */
+	int	pr_shift;	/* Each bucket is 1 << pr_shift bytes. */
+	uint32	pr_user;	/* Ticks in user mode. */
+	uint32	pr_out;		/* Kernel ticks outside the histogram. */
+	uint16	pr_hist[NPROF];
+};
+
+/* profil() commands. */
+#define PROF_STOP	0
+#define PROF_START	1	/* profil(PROF_START, base, shift) */
+#define PROF_READ	2	/* profil(PROF_READ, buf, size) */
+
 /* open() parameters. */
 #define O_RDONLY	0
 #define O_WRONLY	1